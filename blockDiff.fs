@@ -0,0 +1,23 @@
+#version 330 core
+out vec4 FragColor;
+
+// texture samplers
+uniform sampler2D current;
+uniform sampler2D previous;
+uniform int blockSize;
+
+// one fragment per block: the largest difference of any channel between the two frames within it
+void main()
+{
+	ivec2 size=textureSize(current,0);
+	ivec2 origin=ivec2(gl_FragCoord.xy)*blockSize;
+	float difference=0.0;
+	for(int y=0;y<blockSize;++y){
+		for(int x=0;x<blockSize;++x){
+			ivec2 texel=min(origin+ivec2(x,y),size-1);
+			vec4 delta=abs(texelFetch(current,texel,0)-texelFetch(previous,texel,0));
+			difference=max(difference,max(max(delta.r,delta.g),max(delta.b,delta.a)));
+		}
+	}
+	FragColor=vec4(difference,0.0,0.0,1.0);
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+//Test client for the blur daemon (texturesCompleted --daemon). Sends a binary PPM to the daemon through
+//shared memory, optionally several times to measure latency, and writes the blurred result as a PPM.
+//Build with: g++ -std=c++17 blurClient.cpp -o blurClient
+//Usage: blurClient input.ppm output.ppm [fast] [repeat count] [socket path]
+
+#include "blurProtocol.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Reads the RGB pixels of a binary PPM without comments in its header
+bool readPPM(const char* path, std::vector<unsigned char>& rgb, int& width, int& height) {
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+	int maxValue;
+	//the single whitespace after the max value is skipped by the %*c
+	bool valid = fscanf(file, "P6 %d %d %d%*c", &width, &height, &maxValue) == 3 && maxValue == 255 && width > 0 && height > 0;
+	if (valid) {
+		rgb.resize(size_t(width) * height * 3);
+		valid = fread(&rgb[0], 1, rgb.size(), file) == rgb.size();
+	}
+	fclose(file);
+	return valid;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3) {
+		std::cout << "Usage: blurClient input.ppm output.ppm [fast] [repeat count] [socket path]" << std::endl;
+		return -1;
+	}
+	bool fast = argc > 3 && std::string(argv[3]) == "fast";
+	int repeats = argc > 4 ? std::max(1, atoi(argv[4])) : 1;
+	const char* socketPath = argc > 5 ? argv[5] : defaultBlurSocket;
+
+	std::vector<unsigned char> rgb;
+	int width;
+	int height;
+	if (!readPPM(argv[1], rgb, width, height)) {
+		std::cout << "Failed to read " << argv[1] << std::endl;
+		return -1;
+	}
+
+	//the frame lives in a memfd that's shared with the daemon, so it's written once and blurred in place
+	int stride = width * 4;
+	size_t bytes = size_t(stride) * height;
+	//the daemon only maps frames sealed against shrinking, so it can't fault on a truncated one
+	int frame = memfd_create("blurFrame", MFD_ALLOW_SEALING);
+	if (frame < 0 || ftruncate(frame, bytes) != 0 || fcntl(frame, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+		std::cout << "Failed to create shared memory" << std::endl;
+		return -1;
+	}
+	unsigned char* pixels = (unsigned char*)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, frame, 0);
+	if (pixels == MAP_FAILED) {
+		std::cout << "Failed to map shared memory" << std::endl;
+		return -1;
+	}
+
+	int daemon = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+	if (daemon < 0 || connect(daemon, (sockaddr*)&address, sizeof(address)) != 0) {
+		std::cout << "Failed to connect to " << socketPath << std::endl;
+		return -1;
+	}
+
+	double totalTime = 0;
+	double totalDaemonTime = 0;
+	for (int i = 0; i < repeats; i++) {
+		//each repeat blurs the original again rather than the previous result
+		for (size_t pixel = 0; pixel < size_t(width) * height; pixel++) {
+			pixels[pixel * 4] = rgb[pixel * 3];
+			pixels[pixel * 4 + 1] = rgb[pixel * 3 + 1];
+			pixels[pixel * 4 + 2] = rgb[pixel * 3 + 2];
+			pixels[pixel * 4 + 3] = 255;
+		}
+		blurRequest request = { unsigned(i), width, height, stride, fast ? BLUR_FAST : BLUR_SIMPLE, 5, 7 };
+		blurReply reply;
+		auto start = std::chrono::steady_clock::now();
+		if (!sendBlurRequest(daemon, request, frame) || !readAll(daemon, &reply, sizeof(reply)) || reply.m_status != 0) {
+			std::cout << "Request " << i << " failed" << std::endl;
+			return -1;
+		}
+		totalTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		totalDaemonTime += reply.m_milliseconds;
+	}
+	std::cout << "Average round trip " << totalTime / repeats << "ms, of which the daemon took " << totalDaemonTime / repeats << "ms" << std::endl;
+
+	FILE* output = fopen(argv[2], "wb");
+	if (!output) {
+		std::cout << "Failed to write " << argv[2] << std::endl;
+		return -1;
+	}
+	fprintf(output, "P6\n%d %d\n255\n", width, height);
+	for (size_t pixel = 0; pixel < size_t(width) * height; pixel++) {
+		fwrite(&pixels[pixel * 4], 1, 3, output);
+	}
+	fclose(output);
+
+	munmap(pixels, bytes);
+	close(frame);
+	close(daemon);
+	return 0;
+}
@@ -0,0 +1,144 @@
+#ifndef BLUR_PROTOCOL_H
+#define BLUR_PROTOCOL_H
+
+//Protocol between the blur daemon (texturesCompleted --daemon) and its clients, such as blurClient.cpp.
+//A client connects to the daemon's unix socket and sends blurRequests. Each request carries a memfd
+//holding the frame as RGBA8 rows of m_stride bytes. The memfd has to be at least m_stride * m_height
+//bytes and sealed with F_SEAL_SHRINK, so it can't be truncated while the daemon has it mapped. The
+//daemon blurs the frame in place in that shared memory and answers with a blurReply, so the pixels
+//never travel through the socket.
+//Linux only, as it relies on memfd and SCM_RIGHTS
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include <cstring>
+
+const char* const defaultBlurSocket = "/tmp/blurwork.sock";
+
+enum blurRequestStage
+{
+	BLUR_SIMPLE = 0,
+	BLUR_FAST = 1
+};
+
+struct blurRequest
+{
+	unsigned int m_id;
+	int m_width;
+	int m_height;
+	int m_stride;
+	int m_stage;
+	int m_iterations;
+	int m_kernelSize;
+};
+
+struct blurReply
+{
+	unsigned int m_id;
+	//0 on success
+	int m_status;
+	//time the daemon spent on the frame, from upload to readback
+	double m_milliseconds;
+};
+
+//Loops until all of size has been read or written, as stream sockets may transfer less
+inline bool readAll(int socket, void* data, size_t size) {
+	char* bytes = (char*)data;
+	while (size > 0) {
+		ssize_t count = read(socket, bytes, size);
+		if (count <= 0)
+			return false;
+		bytes += count;
+		size -= count;
+	}
+	return true;
+}
+
+inline bool writeAll(int socket, const void* data, size_t size) {
+	const char* bytes = (const char*)data;
+	while (size > 0) {
+		ssize_t count = write(socket, bytes, size);
+		if (count <= 0)
+			return false;
+		bytes += count;
+		size -= count;
+	}
+	return true;
+}
+
+//Sends a request with the frame's file descriptor attached
+inline bool sendBlurRequest(int socket, const blurRequest& request, int frame) {
+	iovec data = { (void*)&request, sizeof(request) };
+	char control[CMSG_SPACE(sizeof(int))] = {};
+	msghdr message = {};
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	cmsghdr* header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(header), &frame, sizeof(int));
+	return sendmsg(socket, &message, 0) == sizeof(request);
+}
+
+//A request being received. Requests can arrive in pieces, so what has come so far is kept per client
+struct blurRequestReader
+{
+	blurRequest m_request;
+	size_t m_received = 0;
+	int m_frame = -1;
+};
+
+//Reads whatever has arrived of the next request without blocking, so a slow client can't hold up the
+//others. Returns 1 when a whole request is in request and frame, which the caller has to close, 0 when
+//more is still to come and -1 when the client disconnected or sent something malformed
+inline int readBlurRequest(int socket, blurRequestReader& reader, blurRequest& request, int& frame) {
+	while (reader.m_received < sizeof(reader.m_request)) {
+		iovec data = { (char*)&reader.m_request + reader.m_received, sizeof(reader.m_request) - reader.m_received };
+		char control[CMSG_SPACE(sizeof(int))] = {};
+		msghdr message = {};
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		ssize_t count = recvmsg(socket, &message, MSG_DONTWAIT);
+		if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return 0;
+		bool malformed = count <= 0;
+		for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+			if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+				int received;
+				memcpy(&received, CMSG_DATA(header), sizeof(int));
+				//only one descriptor per request
+				if (reader.m_frame >= 0) {
+					close(received);
+					malformed = true;
+				}
+				else {
+					reader.m_frame = received;
+				}
+			}
+		}
+		if (malformed) {
+			if (reader.m_frame >= 0)
+				close(reader.m_frame);
+			reader = blurRequestReader();
+			return -1;
+		}
+		reader.m_received += count;
+	}
+	if (reader.m_frame < 0)
+		return -1;
+	request = reader.m_request;
+	frame = reader.m_frame;
+	reader = blurRequestReader();
+	return 1;
+}
+#endif
@@ -0,0 +1,68 @@
+//Headless replayer for blur captures, made with G in texturesCompleted or blurWorkBeginCapture. Runs a capture
+//repeatedly and reports its GPU time, so libblurwork changes can be profiled and compared outside the app.
+//Build with: g++ -std=c++17 blurReplay.cpp blurWork.cpp glad.c -lglfw -ldl -o blurReplay
+//Usage: blurReplay capture.bwc [repeat count] [shader directory]
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "blurWork.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::cout << "Usage: blurReplay capture.bwc [repeat count] [shader directory]" << std::endl;
+		return -1;
+	}
+	int repeats = argc > 2 ? std::max(1, atoi(argv[2])) : 100;
+	const char* shaderDirectory = argc > 3 ? argv[3] : "C:\\Users\\John\\Desktop\\";
+
+	//the replay renders to textures only, so the window is never shown
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* window = glfwCreateWindow(1, 1, "blurReplay", NULL, NULL);
+	if (window == NULL) {
+		std::cout << "Failed to create GLFW window" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+	glfwMakeContextCurrent(window);
+
+	blurWorkContext* context = blurWorkCreate(shaderDirectory, (void* (*)(const char*))glfwGetProcAddress);
+	if (!context) {
+		std::cout << "Failed to build the blur shaders" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+
+	//one untimed run first, as drivers often finish compiling shaders on first use
+	std::vector<double> times(repeats);
+	if (blurWorkReplay(context, argv[1], 1, NULL) != 0 || blurWorkReplay(context, argv[1], repeats, &times[0]) != 0) {
+		std::cout << "Failed to replay " << argv[1] << std::endl;
+		blurWorkDestroy(context);
+		glfwTerminate();
+		return -1;
+	}
+	double total = 0;
+	for (double time : times) {
+		total += time;
+	}
+	std::sort(times.begin(), times.end());
+	std::cout << repeats << " runs of " << argv[1] << ": min " << times.front() << "ms, median " << times[repeats / 2]
+		<< "ms, mean " << total / repeats << "ms, max " << times.back() << "ms" << std::endl;
+
+	blurWorkDestroy(context);
+	glfwTerminate();
+	return 0;
+}
@@ -0,0 +1,779 @@
+#include <glad/glad.h>
+
+#include <learnopengl/shader_s.h>
+
+#include "blurWork.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+//A captured texture: the index of its current version in the capture file, what that version was declared as,
+//and a hash of the contents the capture expects it to hold
+struct capturedTexture
+{
+	int m_index;
+	int m_width;
+	int m_height;
+	GLint m_format;
+	unsigned long long m_hash;
+};
+
+struct blurWorkContext
+{
+	Shader m_simpleShader;
+	Shader m_fastShader;
+	Shader m_halfShader;
+	GLuint m_framebuffer = 0;
+	GLuint m_quadVAO = 0;
+	GLuint m_quadVBO = 0;
+
+	int m_stage = BLURWORK_SIMPLE;
+	int m_iterations = 5;
+	//Kernel for the simple stage. m_weights[i] applies to the texel at offset i - m_centre
+	std::vector<float> m_weights = { 1.0f };
+	int m_centre = 0;
+	bool m_mergeTaps = true;
+	//1D RG32F texture of (offset, weight) taps read by simpleBlur.fs, and what was last uploaded to it
+	GLuint m_tapTexture = 0;
+	std::vector<float> m_uploadedTaps;
+
+	//Working texture given by the caller, and the context's own one used when that doesn't fit
+	GLuint m_callerWorking = 0;
+	int m_callerWorkingWidth = 0;
+	int m_callerWorkingHeight = 0;
+	GLuint m_ownWorking = 0;
+	int m_ownWorkingWidth = 0;
+	int m_ownWorkingHeight = 0;
+	GLint m_ownWorkingFormat = 0;
+
+	//Texture the buffer path uploads to and blurs in place
+	GLuint m_bufferTexture = 0;
+	int m_bufferWidth = 0;
+	int m_bufferHeight = 0;
+
+	//Capture file while capturing, and the textures declared in it so far
+	FILE* m_capture = nullptr;
+	std::map<GLuint, capturedTexture> m_captured;
+	int m_capturedCount = 0;
+};
+
+namespace
+{
+	//Pixel store parameters that affect 2D transfers, and their defaults
+	const GLenum pixelStoreNames[8] = { GL_PACK_ALIGNMENT, GL_PACK_ROW_LENGTH, GL_PACK_SKIP_ROWS, GL_PACK_SKIP_PIXELS,
+		GL_UNPACK_ALIGNMENT, GL_UNPACK_ROW_LENGTH, GL_UNPACK_SKIP_ROWS, GL_UNPACK_SKIP_PIXELS };
+	const GLint pixelStoreDefaults[8] = { 4, 0, 0, 0, 4, 0, 0, 0 };
+
+	//The caller's GL state that the entry points change. Saved on construction and put back on destruction,
+	//so the library can be called in the middle of someone else's rendering. Texture unit 0 is made active,
+	//pixel buffers unbound and the pixel store reset, so the library starts from the same state every call
+	struct savedGLState
+	{
+		GLint m_drawFramebuffer;
+		GLint m_readFramebuffer;
+		GLint m_viewport[4];
+		GLint m_program;
+		GLint m_activeTexture;
+		GLint m_texture2D[2];
+		GLint m_texture1D[2];
+		GLint m_vertexArray;
+		GLint m_arrayBuffer;
+		GLint m_packBuffer;
+		GLint m_unpackBuffer;
+		GLint m_pixelStore[8];
+
+		savedGLState() {
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_drawFramebuffer);
+			glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &m_readFramebuffer);
+			glGetIntegerv(GL_VIEWPORT, m_viewport);
+			glGetIntegerv(GL_CURRENT_PROGRAM, &m_program);
+			glGetIntegerv(GL_ACTIVE_TEXTURE, &m_activeTexture);
+			for (int unit = 0; unit < 2; unit++) {
+				glActiveTexture(GL_TEXTURE0 + unit);
+				glGetIntegerv(GL_TEXTURE_BINDING_2D, &m_texture2D[unit]);
+				glGetIntegerv(GL_TEXTURE_BINDING_1D, &m_texture1D[unit]);
+			}
+			glActiveTexture(GL_TEXTURE0);
+			glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &m_vertexArray);
+			glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &m_arrayBuffer);
+			glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &m_packBuffer);
+			glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &m_unpackBuffer);
+			//buffer transfers use client memory
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			for (int i = 0; i < 8; i++) {
+				glGetIntegerv(pixelStoreNames[i], &m_pixelStore[i]);
+				glPixelStorei(pixelStoreNames[i], pixelStoreDefaults[i]);
+			}
+		}
+
+		~savedGLState() {
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_drawFramebuffer);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readFramebuffer);
+			glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+			glUseProgram(m_program);
+			for (int unit = 0; unit < 2; unit++) {
+				glActiveTexture(GL_TEXTURE0 + unit);
+				glBindTexture(GL_TEXTURE_2D, m_texture2D[unit]);
+				glBindTexture(GL_TEXTURE_1D, m_texture1D[unit]);
+			}
+			glActiveTexture(m_activeTexture);
+			glBindVertexArray(m_vertexArray);
+			glBindBuffer(GL_ARRAY_BUFFER, m_arrayBuffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, m_packBuffer);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_unpackBuffer);
+			for (int i = 0; i < 8; i++) {
+				glPixelStorei(pixelStoreNames[i], m_pixelStore[i]);
+			}
+		}
+	};
+
+	bool linked(const Shader& shader) {
+		int success;
+		glGetProgramiv(shader.ID, GL_LINK_STATUS, &success);
+		return success != 0;
+	}
+
+	void textureSize(GLuint texture, int& width, int& height) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	}
+
+	GLint textureFormat(GLuint texture) {
+		GLint format;
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+		return format;
+	}
+
+	//(Re)allocates a texture with clamp to edge addressing and linear filtering
+	void allocateTexture(GLuint& texture, int width, int height, GLint format) {
+		if (texture == 0) {
+			glGenTextures(1, &texture);
+		}
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	//Working texture for an output of the given size. The context's own one also matches the output's format,
+	//so single channel outputs get single channel intermediates
+	GLuint workingTexture(blurWorkContext* context, GLuint output, int width, int height) {
+		if (context->m_callerWorking != 0 && context->m_callerWorkingWidth == width && context->m_callerWorkingHeight == height) {
+			return context->m_callerWorking;
+		}
+		GLint format = textureFormat(output);
+		if (context->m_ownWorkingWidth != width || context->m_ownWorkingHeight != height || context->m_ownWorkingFormat != format) {
+			allocateTexture(context->m_ownWorking, width, height, format);
+			context->m_ownWorkingWidth = width;
+			context->m_ownWorkingHeight = height;
+			context->m_ownWorkingFormat = format;
+		}
+		return context->m_ownWorking;
+	}
+
+	//Converts the kernel into the (offset, weight) pairs simpleBlur.fs reads. When merging, adjacent weights
+	//with the same sign become one linear fetch placed between the two texels so the hardware filter applies
+	//both, roughly halving the fetches
+	std::vector<float> kernelTaps(const blurWorkContext* context) {
+		std::vector<float> taps;
+		const std::vector<float>& weights = context->m_weights;
+		int count = int(weights.size());
+		for (int i = 0; i < count; i++) {
+			if (weights[i] == 0) {
+				continue;
+			}
+			if (context->m_mergeTaps && i + 1 < count && weights[i] * weights[i + 1] > 0) {
+				float weight = weights[i] + weights[i + 1];
+				taps.push_back(i - context->m_centre + weights[i + 1] / weight);
+				taps.push_back(weight);
+				i++;
+			}
+			else {
+				taps.push_back(float(i - context->m_centre));
+				taps.push_back(weights[i]);
+			}
+		}
+		return taps;
+	}
+
+	//Uploads the taps if the kernel changed since the last upload and returns how many there are
+	int uploadTaps(blurWorkContext* context) {
+		std::vector<float> taps = kernelTaps(context);
+		if (taps != context->m_uploadedTaps) {
+			if (context->m_tapTexture == 0) {
+				glGenTextures(1, &context->m_tapTexture);
+				glBindTexture(GL_TEXTURE_1D, context->m_tapTexture);
+				glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			}
+			glBindTexture(GL_TEXTURE_1D, context->m_tapTexture);
+			glTexImage1D(GL_TEXTURE_1D, 0, GL_RG32F, GLsizei(std::max<size_t>(taps.size() / 2, 1)), 0, GL_RG, GL_FLOAT, taps.empty() ? NULL : &taps[0]);
+			context->m_uploadedTaps = taps;
+		}
+		return int(taps.size() / 2);
+	}
+
+	void renderQuad(blurWorkContext* context) {
+		if (context->m_quadVAO == 0)
+		{
+			float quadVertices[] = {
+				// positions        // texture Coords
+				-1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
+				-1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+				 1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
+				 1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+			};
+			glGenVertexArrays(1, &context->m_quadVAO);
+			glGenBuffers(1, &context->m_quadVBO);
+			glBindVertexArray(context->m_quadVAO);
+			glBindBuffer(GL_ARRAY_BUFFER, context->m_quadVBO);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+		}
+		glBindVertexArray(context->m_quadVAO);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glBindVertexArray(0);
+	}
+
+	//Capture files start with "BWCP" and a version, followed by records that each start with a one byte tag.
+	//Integers and floats are written in the machine's byte order.
+	//'T' declares a texture: index, width, height, internal format, swizzle[4], has pixels, then RGBA8 pixels if it has them
+	//'B' is a blurWorkBlurTexture call: input, output, scissor enabled, scissor[4], stage, iterations, merge taps,
+	//centre, weight count, then the weights
+	//'H' is a blurWorkHalf call: input, output, scissor enabled, scissor[4]
+	const char captureMagic[4] = { 'B', 'W', 'C', 'P' };
+	const int captureVersion = 1;
+
+	void writeInts(FILE* file, const int* values, int count) {
+		fwrite(values, sizeof(int), count, file);
+	}
+
+	bool readInts(FILE* file, int* values, int count) {
+		return fread(values, sizeof(int), count, file) == size_t(count);
+	}
+
+	//Reads a texture back as RGBA8
+	std::vector<unsigned char> texturePixels(GLuint texture, int width, int height) {
+		std::vector<unsigned char> pixels(size_t(width) * height * 4);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+		return pixels;
+	}
+
+	//64 bit FNV-1a
+	unsigned long long hashPixels(const std::vector<unsigned char>& pixels) {
+		unsigned long long hash = 14695981039346656037ull;
+		for (unsigned char value : pixels) {
+			hash = (hash ^ value) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	//Index of texture's current version in the capture, declaring it first if it's new, was reallocated since,
+	//or holds contents no recorded call produced. GL names are reused once the app deletes a texture, so the
+	//contents are compared by hash rather than trusting the name. Declarations of textures whose contents
+	//matter to the call include their pixels
+	int captureTexture(blurWorkContext* context, GLuint texture, bool read) {
+		int width;
+		int height;
+		textureSize(texture, width, height);
+		GLint format = textureFormat(texture);
+		std::vector<unsigned char> pixels = texturePixels(texture, width, height);
+		unsigned long long hash = hashPixels(pixels);
+		auto found = context->m_captured.find(texture);
+		if (found != context->m_captured.end() && found->second.m_width == width && found->second.m_height == height
+			&& found->second.m_format == format && found->second.m_hash == hash) {
+			return found->second.m_index;
+		}
+		capturedTexture captured = { context->m_capturedCount++, width, height, format, hash };
+		context->m_captured[texture] = captured;
+		glBindTexture(GL_TEXTURE_2D, texture);
+		GLint swizzle[4];
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		int declaration[9] = { captured.m_index, width, height, format, swizzle[0], swizzle[1], swizzle[2], swizzle[3], read };
+		fputc('T', context->m_capture);
+		writeInts(context->m_capture, declaration, 9);
+		if (read) {
+			fwrite(&pixels[0], 1, pixels.size(), context->m_capture);
+		}
+		return captured.m_index;
+	}
+
+	//Records what a call left in its output, so the next call reading it can tell it's unchanged since
+	void captureResult(blurWorkContext* context, GLuint output) {
+		capturedTexture& captured = context->m_captured[output];
+		captured.m_hash = hashPixels(texturePixels(output, captured.m_width, captured.m_height));
+	}
+
+	//Writes the inputs, output and scissor shared by both kinds of call record
+	void captureCall(blurWorkContext* context, char tag, GLuint input, GLuint output) {
+		int scissor[5] = { glIsEnabled(GL_SCISSOR_TEST) };
+		int inputIndex = captureTexture(context, input, true);
+		//in place calls read the input's contents before they're overwritten, so it's declared first. A scissored
+		//call leaves the rest of the output as it was, so then its pixels are saved too
+		int outputIndex = captureTexture(context, output, scissor[0] != 0);
+		glGetIntegerv(GL_SCISSOR_BOX, &scissor[1]);
+		int textures[2] = { inputIndex, outputIndex };
+		fputc(tag, context->m_capture);
+		writeInts(context->m_capture, textures, 2);
+		writeInts(context->m_capture, scissor, 5);
+	}
+}
+
+blurWorkContext* blurWorkCreate(const char* shaderDirectory, void* (*getProcAddress)(const char*)) {
+	if (getProcAddress && !gladLoadGLLoader((GLADloadproc)getProcAddress)) {
+		return nullptr;
+	}
+	std::string directory = shaderDirectory ? shaderDirectory : "";
+	blurWorkContext* context = new blurWorkContext();
+	context->m_simpleShader = Shader(directory + "simpleBlur.vs", directory + "simpleBlur.fs");
+	context->m_fastShader = Shader(directory + "fastBlur.vs", directory + "fastBlur.fs");
+	context->m_halfShader = Shader(directory + "half.vs", directory + "half.fs");
+	if (!linked(context->m_simpleShader) || !linked(context->m_fastShader) || !linked(context->m_halfShader)) {
+		blurWorkDestroy(context);
+		return nullptr;
+	}
+	glGenFramebuffers(1, &context->m_framebuffer);
+	return context;
+}
+
+void blurWorkDestroy(blurWorkContext* context) {
+	if (!context) {
+		return;
+	}
+	glDeleteProgram(context->m_simpleShader.ID);
+	glDeleteProgram(context->m_fastShader.ID);
+	glDeleteProgram(context->m_halfShader.ID);
+	glDeleteFramebuffers(1, &context->m_framebuffer);
+	glDeleteVertexArrays(1, &context->m_quadVAO);
+	glDeleteBuffers(1, &context->m_quadVBO);
+	glDeleteTextures(1, &context->m_tapTexture);
+	glDeleteTextures(1, &context->m_ownWorking);
+	glDeleteTextures(1, &context->m_bufferTexture);
+	blurWorkEndCapture(context);
+	delete context;
+}
+
+int blurWorkSetKernel(blurWorkContext* context, const float* weights, int count, int centre) {
+	if (!weights || count <= 0 || centre < 0 || centre >= count) {
+		return -1;
+	}
+	context->m_weights.assign(weights, weights + count);
+	context->m_centre = centre;
+	return 0;
+}
+
+int blurWorkSetGaussian(blurWorkContext* context, float sigma, int radius) {
+	if (sigma <= 0 || radius < 0) {
+		return -1;
+	}
+	std::vector<float> weights;
+	float sum = 0;
+	for (int i = -radius; i <= radius; i++) {
+		weights.push_back(exp(-0.5f * i * i / (sigma * sigma)));
+		sum += weights.back();
+	}
+	for (float& weight : weights) {
+		weight /= sum;
+	}
+	return blurWorkSetKernel(context, &weights[0], int(weights.size()), radius);
+}
+
+void blurWorkSetStage(blurWorkContext* context, int stage) {
+	context->m_stage = stage;
+}
+
+void blurWorkSetIterations(blurWorkContext* context, int iterations) {
+	context->m_iterations = std::max(iterations, 0);
+}
+
+void blurWorkSetMergeTaps(blurWorkContext* context, int merge) {
+	context->m_mergeTaps = merge != 0;
+}
+
+void blurWorkSetWorkingTexture(blurWorkContext* context, unsigned int texture) {
+	savedGLState saved;
+	context->m_callerWorking = texture;
+	context->m_callerWorkingWidth = 0;
+	context->m_callerWorkingHeight = 0;
+	if (texture != 0) {
+		textureSize(texture, context->m_callerWorkingWidth, context->m_callerWorkingHeight);
+	}
+}
+
+//Horizontal passes go from the input (then the output) into the working texture, vertical ones from the
+//working texture into the output. The input is only read by the first horizontal pass, so in place works
+int blurWorkBlurTexture(blurWorkContext* context, unsigned int input, unsigned int output) {
+	savedGLState saved;
+	int width;
+	int height;
+	textureSize(output, width, height);
+	if (width <= 0 || height <= 0) {
+		return -1;
+	}
+	if (context->m_capture) {
+		captureCall(context, 'B', input, output);
+		int settings[5] = { context->m_stage, context->m_iterations, context->m_mergeTaps, context->m_centre, int(context->m_weights.size()) };
+		writeInts(context->m_capture, settings, 5);
+		fwrite(&context->m_weights[0], sizeof(float), context->m_weights.size(), context->m_capture);
+	}
+	GLuint working = workingTexture(context, output, width, height);
+
+	Shader& shader = context->m_stage == BLURWORK_FAST ? context->m_fastShader : context->m_simpleShader;
+	shader.use();
+	if (context->m_stage != BLURWORK_FAST) {
+		int tapCount = uploadTaps(context);
+		shader.setInt("image", 0);
+		shader.setInt("taps", 1);
+		shader.setInt("tapCount", tapCount);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_1D, context->m_tapTexture);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glBindFramebuffer(GL_FRAMEBUFFER, context->m_framebuffer);
+	glViewport(0, 0, width, height);
+
+	GLuint temp = input;
+	for (int i = 0; i < context->m_iterations; i++) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, working, 0);
+		glBindTexture(GL_TEXTURE_2D, temp);
+		shader.setBool("horizontal", true);
+		renderQuad(context);
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output, 0);
+		glBindTexture(GL_TEXTURE_2D, working);
+		shader.setBool("horizontal", false);
+		renderQuad(context);
+		temp = output;
+	}
+	if (context->m_capture) {
+		captureResult(context, output);
+	}
+	return 0;
+}
+
+//Gaussians convolve into a gaussian whose variance is the sum of theirs, so output i only needs
+//sqrt(sigmas[i]^2 - sigmas[i - 1]^2) more blur on top of output i - 1
+int blurWorkBlurGaussians(blurWorkContext* context, unsigned int input, const unsigned int* outputs, const float* sigmas, int count) {
+	if (!outputs || !sigmas || count <= 0 || sigmas[0] <= 0) {
+		return -1;
+	}
+	for (int i = 1; i < count; i++) {
+		if (sigmas[i] < sigmas[i - 1]) {
+			return -1;
+		}
+	}
+	savedGLState saved;
+	std::vector<float> weights = context->m_weights;
+	int centre = context->m_centre;
+	int iterations = context->m_iterations;
+	int stage = context->m_stage;
+	context->m_iterations = 1;
+	context->m_stage = BLURWORK_SIMPLE;
+
+	int result = 0;
+	float previous = 0;
+	for (int i = 0; i < count && result == 0; i++) {
+		float sigma = std::sqrt(sigmas[i] * sigmas[i] - previous * previous);
+		//equal sigmas just copy the previous output through a single tap
+		if (sigma < 0.01f) {
+			context->m_weights = { 1.0f };
+			context->m_centre = 0;
+		}
+		else {
+			blurWorkSetGaussian(context, sigma, int(std::ceil(3 * sigma)));
+		}
+		result = blurWorkBlurTexture(context, i == 0 ? input : outputs[i - 1], outputs[i]);
+		previous = sigmas[i];
+	}
+
+	context->m_weights = weights;
+	context->m_centre = centre;
+	context->m_iterations = iterations;
+	context->m_stage = stage;
+	return result;
+}
+
+int blurWorkHalf(blurWorkContext* context, unsigned int input, unsigned int output) {
+	savedGLState saved;
+	int width;
+	int height;
+	textureSize(output, width, height);
+	if (width <= 0 || height <= 0) {
+		return -1;
+	}
+	if (context->m_capture) {
+		captureCall(context, 'H', input, output);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, context->m_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output, 0);
+	glViewport(0, 0, width, height);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, input);
+	context->m_halfShader.use();
+	renderQuad(context);
+	if (context->m_capture) {
+		captureResult(context, output);
+	}
+	return 0;
+}
+
+//The caller's strides are given to GL as row lengths, so neither side needs repacking
+int blurWorkBlurBuffer(blurWorkContext* context, const void* input, int inputStride, void* output, int outputStride, int width, int height) {
+	if (!input || !output || width <= 0 || height <= 0 || inputStride < width * 4 || outputStride < width * 4
+		|| inputStride % 4 != 0 || outputStride % 4 != 0) {
+		return -1;
+	}
+	savedGLState saved;
+	glBindTexture(GL_TEXTURE_2D, context->m_bufferTexture);
+	if (context->m_bufferWidth != width || context->m_bufferHeight != height) {
+		allocateTexture(context->m_bufferTexture, width, height, GL_RGBA8);
+		context->m_bufferWidth = width;
+		context->m_bufferHeight = height;
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, inputStride / 4);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, input);
+
+	blurWorkBlurTexture(context, context->m_bufferTexture, context->m_bufferTexture);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, context->m_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, context->m_bufferTexture, 0);
+	glPixelStorei(GL_PACK_ROW_LENGTH, outputStride / 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, output);
+	return 0;
+}
+
+//Ping-pongs through a working buffer the same way the GPU path does. Uses the unmerged weights, so it's exact
+int blurWorkConvolveCPU(float* pixels, int width, int height, int stride, int channels,
+	const float* weights, int count, int centre, int iterations) {
+	if (!pixels || !weights || width <= 0 || height <= 0 || channels <= 0 || stride < width * channels || count <= 0) {
+		return -1;
+	}
+	std::vector<float> working(size_t(width) * height * channels);
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		for (int y = 0; y < height; y++) {
+			const float* row = pixels + size_t(y) * stride;
+			for (int x = 0; x < width; x++) {
+				for (int c = 0; c < channels; c++) {
+					float value = 0;
+					for (int i = 0; i < count; i++) {
+						int sample = std::min(std::max(x + i - centre, 0), width - 1);
+						value += row[sample * channels + c] * weights[i];
+					}
+					working[(size_t(y) * width + x) * channels + c] = value;
+				}
+			}
+		}
+		for (int y = 0; y < height; y++) {
+			float* row = pixels + size_t(y) * stride;
+			for (int x = 0; x < width; x++) {
+				for (int c = 0; c < channels; c++) {
+					float value = 0;
+					for (int i = 0; i < count; i++) {
+						int sample = std::min(std::max(y + i - centre, 0), height - 1);
+						value += working[(size_t(sample) * width + x) * channels + c] * weights[i];
+					}
+					row[x * channels + c] = value;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+int blurWorkBeginCapture(blurWorkContext* context, const char* path) {
+	if (context->m_capture || !path) {
+		return -1;
+	}
+	context->m_capture = fopen(path, "wb");
+	if (!context->m_capture) {
+		return -1;
+	}
+	fwrite(captureMagic, 1, 4, context->m_capture);
+	writeInts(context->m_capture, &captureVersion, 1);
+	context->m_captured.clear();
+	context->m_capturedCount = 0;
+	return 0;
+}
+
+int blurWorkEndCapture(blurWorkContext* context) {
+	if (!context->m_capture) {
+		return -1;
+	}
+	bool written = fclose(context->m_capture) == 0;
+	context->m_capture = nullptr;
+	context->m_captured.clear();
+	return written ? 0 : -1;
+}
+
+//A recorded call: tag, texture indices, scissor, and for blurs the settings and kernel
+struct capturedCall
+{
+	char m_tag;
+	int m_textures[2];
+	int m_scissor[5];
+	int m_settings[5];
+	std::vector<float> m_weights;
+};
+
+//Loads the whole capture, creating its textures up front so the timed runs only contain the recorded calls
+int blurWorkReplay(blurWorkContext* context, const char* path, int repeats, double* milliseconds) {
+	if (context->m_capture || !path || repeats <= 0) {
+		return -1;
+	}
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return -1;
+	}
+	savedGLState saved;
+	char magic[4];
+	int version;
+	bool valid = fread(magic, 1, 4, file) == 4 && std::equal(magic, magic + 4, captureMagic) && readInts(file, &version, 1)
+		&& version == captureVersion;
+	std::vector<GLuint> textures;
+	std::vector<capturedTexture> declarations;
+	std::vector<capturedCall> calls;
+	int tag;
+	while (valid && (tag = fgetc(file)) != EOF) {
+		if (tag == 'T') {
+			int declaration[9];
+			valid = readInts(file, declaration, 9) && declaration[0] == int(textures.size()) && declaration[1] > 0 && declaration[2] > 0;
+			if (!valid) {
+				break;
+			}
+			std::vector<unsigned char> pixels;
+			if (declaration[8]) {
+				pixels.resize(size_t(declaration[1]) * declaration[2] * 4);
+				valid = fread(&pixels[0], 1, pixels.size(), file) == pixels.size();
+			}
+			GLuint texture = 0;
+			allocateTexture(texture, declaration[1], declaration[2], declaration[3]);
+			glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, &declaration[4]);
+			if (!pixels.empty()) {
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, declaration[1], declaration[2], GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+			}
+			textures.push_back(texture);
+			declarations.push_back({ declaration[0], declaration[1], declaration[2], declaration[3], 0 });
+		}
+		else if (tag == 'B' || tag == 'H') {
+			capturedCall call;
+			call.m_tag = char(tag);
+			valid = readInts(file, call.m_textures, 2) && readInts(file, call.m_scissor, 5);
+			if (valid && tag == 'B') {
+				valid = readInts(file, call.m_settings, 5) && call.m_settings[4] > 0 && call.m_settings[3] >= 0 && call.m_settings[3] < call.m_settings[4];
+				if (valid) {
+					call.m_weights.resize(call.m_settings[4]);
+					valid = fread(&call.m_weights[0], sizeof(float), call.m_weights.size(), file) == call.m_weights.size();
+				}
+			}
+			for (int index : call.m_textures) {
+				valid = valid && index >= 0 && index < int(textures.size());
+			}
+			calls.push_back(call);
+		}
+		else {
+			valid = false;
+		}
+	}
+	fclose(file);
+
+	//the app lends its working textures, so each output size and format gets one made before the timed runs
+	//rather than the context reallocating its own whenever they change
+	std::map<std::vector<int>, GLuint> working;
+	for (size_t i = 0; valid && i < calls.size(); i++) {
+		const capturedTexture& output = declarations[calls[i].m_textures[1]];
+		GLuint& texture = working[{ output.m_width, output.m_height, output.m_format }];
+		if (calls[i].m_tag == 'B' && texture == 0) {
+			allocateTexture(texture, output.m_width, output.m_height, output.m_format);
+		}
+	}
+
+	if (valid) {
+		std::vector<float> weights = context->m_weights;
+		int centre = context->m_centre;
+		int iterations = context->m_iterations;
+		int stage = context->m_stage;
+		bool mergeTaps = context->m_mergeTaps;
+		GLuint callerWorking = context->m_callerWorking;
+		int callerWorkingWidth = context->m_callerWorkingWidth;
+		int callerWorkingHeight = context->m_callerWorkingHeight;
+		GLboolean scissorTest = glIsEnabled(GL_SCISSOR_TEST);
+		GLint scissorBox[4];
+		glGetIntegerv(GL_SCISSOR_BOX, scissorBox);
+
+		GLuint query;
+		glGenQueries(1, &query);
+		for (int run = 0; run < repeats; run++) {
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			for (const capturedCall& call : calls) {
+				if (call.m_scissor[0]) {
+					glEnable(GL_SCISSOR_TEST);
+					glScissor(call.m_scissor[1], call.m_scissor[2], call.m_scissor[3], call.m_scissor[4]);
+				}
+				else {
+					glDisable(GL_SCISSOR_TEST);
+				}
+				if (call.m_tag == 'H') {
+					blurWorkHalf(context, textures[call.m_textures[0]], textures[call.m_textures[1]]);
+					continue;
+				}
+				context->m_stage = call.m_settings[0];
+				context->m_iterations = call.m_settings[1];
+				context->m_mergeTaps = call.m_settings[2] != 0;
+				context->m_centre = call.m_settings[3];
+				context->m_weights = call.m_weights;
+				const capturedTexture& output = declarations[call.m_textures[1]];
+				context->m_callerWorking = working[{ output.m_width, output.m_height, output.m_format }];
+				context->m_callerWorkingWidth = output.m_width;
+				context->m_callerWorkingHeight = output.m_height;
+				blurWorkBlurTexture(context, textures[call.m_textures[0]], textures[call.m_textures[1]]);
+			}
+			glEndQuery(GL_TIME_ELAPSED);
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			if (milliseconds) {
+				milliseconds[run] = elapsed / 1000000.0;
+			}
+		}
+		glDeleteQueries(1, &query);
+
+		context->m_weights = weights;
+		context->m_centre = centre;
+		context->m_iterations = iterations;
+		context->m_stage = stage;
+		context->m_mergeTaps = mergeTaps;
+		context->m_callerWorking = callerWorking;
+		context->m_callerWorkingWidth = callerWorkingWidth;
+		context->m_callerWorkingHeight = callerWorkingHeight;
+		if (scissorTest) {
+			glEnable(GL_SCISSOR_TEST);
+		}
+		else {
+			glDisable(GL_SCISSOR_TEST);
+		}
+		glScissor(scissorBox[0], scissorBox[1], scissorBox[2], scissorBox[3]);
+	}
+	for (GLuint texture : textures) {
+		glDeleteTextures(1, &texture);
+	}
+	for (const auto& entry : working) {
+		glDeleteTextures(1, &entry.second);
+	}
+	return valid ? 0 : -1;
+}
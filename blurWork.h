@@ -0,0 +1,85 @@
+#ifndef BLUR_WORK_H
+#define BLUR_WORK_H
+
+/*
+ * libblurwork: the separable blur passes from texturesCompleted.cpp behind a C API.
+ *
+ * A blurWorkContext owns its shaders, framebuffer, tap texture and any scratch textures, so several
+ * contexts can be used independently in one process. Each must only be used with the GL context that was
+ * current when it was created: its framebuffer and vertex array aren't shared with other contexts, even in
+ * the same share group. Textures and buffers passed in stay owned by the caller and are written directly.
+ * Where input and output are the same the blur happens in place.
+ *
+ * Every call leaves the GL state it touches as it found it: framebuffer bindings, viewport, program,
+ * active texture and the bindings on units 0 and 1, vertex array, array and pixel buffer bindings, and the
+ * pixel store parameters. Blending, scissor and other fixed function state are used as the caller set them.
+ *
+ * Textures are GL texture names. Output textures have to be colour renderable and are blurred at their
+ * own size, and all four channels are blurred, so R8 and RG8 targets only cost their own bandwidth. Buffers
+ * are RGBA8 rows of stride bytes. Functions returning int return 0 on success.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct blurWorkContext blurWorkContext;
+
+enum blurWorkStage
+{
+	/* separable convolution with the kernel set by blurWorkSetKernel or blurWorkSetGaussian */
+	BLURWORK_SIMPLE = 0,
+	/* fixed hardware interpolated gaussian from fastBlur.fs */
+	BLURWORK_FAST = 1
+};
+
+/* Creates a context. shaderDirectory is prepended to the shader file names (simpleBlur.vs and so on).
+ * If getProcAddress isn't null it's used to load the GL functions, which a shared build of the library
+ * needs as it has its own function pointers. Returns null if the shaders fail to build */
+blurWorkContext* blurWorkCreate(const char* shaderDirectory, void* (*getProcAddress)(const char*));
+void blurWorkDestroy(blurWorkContext* context);
+
+/* weights[i] applies to the texel at offset i - centre. Any length, symmetric or not */
+int blurWorkSetKernel(blurWorkContext* context, const float* weights, int count, int centre);
+/* Sampled and normalized gaussian covering +-radius */
+int blurWorkSetGaussian(blurWorkContext* context, float sigma, int radius);
+void blurWorkSetStage(blurWorkContext* context, int stage);
+/* Number of horizontal + vertical pass pairs */
+void blurWorkSetIterations(blurWorkContext* context, int iterations);
+/* Whether adjacent taps with the same sign are merged into one linear fetch. On by default */
+void blurWorkSetMergeTaps(blurWorkContext* context, int merge);
+/* Optional caller owned texture for the result of the horizontal passes. It's used for outputs of the same
+ * size, otherwise the context allocates its own. 0 goes back to the context's own */
+void blurWorkSetWorkingTexture(blurWorkContext* context, unsigned int texture);
+
+/* Blurs input into output, which may be the same texture */
+int blurWorkBlurTexture(blurWorkContext* context, unsigned int input, unsigned int output);
+/* Blurs input with several gaussians: outputs[i] gets sigmas[i] pixels, which must be ascending. Each output
+ * is made from the previous one with the gaussian that makes up the difference, as variances add, so each
+ * radius only pays for its increase over the previous one. Always uses the simple stage, and leaves the
+ * context's kernel, iterations and stage as they were. Outputs must all be the same size */
+int blurWorkBlurGaussians(blurWorkContext* context, unsigned int input, const unsigned int* outputs, const float* sigmas, int count);
+/* Downsamples input into output, which should be half its size */
+int blurWorkHalf(blurWorkContext* context, unsigned int input, unsigned int output);
+/* Uploads an RGBA8 buffer, blurs it and reads the result into output, which may be the same buffer */
+int blurWorkBlurBuffer(blurWorkContext* context, const void* input, int inputStride, void* output, int outputStride, int width, int height);
+
+/* Records every blurWorkBlurTexture and blurWorkHalf call to path, with the sizes, formats, scissor and settings
+ * it ran with. Textures a call reads that no recorded call wrote are saved with their contents, so the
+ * capture reproduces the same GL work on its own. Textures are told apart by a hash of their contents, so
+ * every recorded call reads its textures back and captured frames run much slower than normal ones.
+ * Fails if this context is already capturing */
+int blurWorkBeginCapture(blurWorkContext* context, const char* path);
+int blurWorkEndCapture(blurWorkContext* context);
+/* Loads a capture and runs its calls repeats times on textures of its own. If milliseconds isn't null it
+ * receives the GPU time of each run. Leaves the context's settings as they were */
+int blurWorkReplay(blurWorkContext* context, const char* path, int repeats, double* milliseconds);
+
+/* CPU separable convolution of float pixels in place, with clamp to edge addressing. stride is in floats */
+int blurWorkConvolveCPU(float* pixels, int width, int height, int stride, int channels,
+	const float* weights, int count, int centre, int iterations);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
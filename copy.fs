@@ -0,0 +1,10 @@
+#version 330 core
+out vec4 FragColor;
+
+// texture sampler
+uniform sampler2D image;
+
+void main()
+{
+	FragColor = texelFetch(image, ivec2(gl_FragCoord.xy), 0);
+}
\ No newline at end of file
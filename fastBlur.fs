@@ -169,14 +169,14 @@ const float gOffsets32[32] ={
    62.46208
 };
 
-vec3 GaussianBlur( sampler2D tex0, vec2 centreUV, vec2 pixelOffset )                                                                           
+vec4 GaussianBlur( sampler2D tex0, vec2 centreUV, vec2 pixelOffset )                                                                           
 {                                                                                                                                                                    
-    vec3 colOut = vec3( 0, 0, 0 );                                                                                                                                   
+    vec4 colOut = vec4( 0, 0, 0, 0 );                                                                                                                                   
                                                                                                                                                         
     for( int i = 0; i < 2; i++ )                                                                                                                             
     {                                                                                                                                                                
         vec2 texCoordOffset = gOffsets2[i] * pixelOffset;                                                                                                           
-        vec3 col = texture( tex0, centreUV + texCoordOffset ).xyz + texture( tex0, centreUV - texCoordOffset ).xyz;                                                
+        vec4 col = texture( tex0, centreUV + texCoordOffset ) + texture( tex0, centreUV - texCoordOffset );                                                
         colOut += gWeights2[i] * col;                                                                                                                               
     }                                                                                                                                                                
                                                                                                                                                                      
@@ -193,6 +193,6 @@ void main()
    else{
      size.x=0;
    }
-   FragColor.rgb=GaussianBlur(uTex0,vTexCoord,size);
-   FragColor.a=1;
+   // alpha is blurred too, it's 1 for RGB sources and premultiplied otherwise
+   FragColor=GaussianBlur(uTex0,vTexCoord,size);
 }
\ No newline at end of file
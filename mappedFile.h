@@ -0,0 +1,97 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+
+//Read only memory mapping of a whole file. The mapping is released when the object is destroyed
+class mappedFile
+{
+public:
+	mappedFile() {}
+	~mappedFile() { close(); }
+	mappedFile(const mappedFile&) = delete;
+	mappedFile& operator=(const mappedFile&) = delete;
+
+	bool open(const std::string& path)
+	{
+		close();
+#ifdef _WIN32
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+			close();
+			return false;
+		}
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapping == NULL) {
+			close();
+			return false;
+		}
+		m_data = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		m_size = size_t(size.QuadPart);
+#else
+		int file = ::open(path.c_str(), O_RDONLY);
+		if (file < 0)
+			return false;
+		struct stat info;
+		if (fstat(file, &info) != 0 || info.st_size == 0) {
+			::close(file);
+			return false;
+		}
+		void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		//the mapping stays valid after the descriptor is closed
+		::close(file);
+		m_data = data == MAP_FAILED ? nullptr : (const unsigned char*)data;
+		m_size = size_t(info.st_size);
+#endif
+		if (!m_data) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping != NULL)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data)
+			munmap((void*)m_data, m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	const unsigned char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	const unsigned char* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = NULL;
+#endif
+};
+#endif
@@ -6,24 +6,19 @@ in vec2 TexCoords;
 // texture sampler
 uniform bool horizontal;
 uniform sampler2D image;
-uniform float weight[30];
-uniform float kernelSize;
+// (offset in texels, weight) of each tap. Offsets are fractional where two taps were merged into one linear fetch
+uniform sampler1D taps;
+uniform int tapCount;
 
 void main()
 {
 	vec2 tex_offset=1.0/textureSize(image,0);
-	vec3 result=texture(image,TexCoords).rgb*weight[0];
-	if(horizontal){
-		for(int i=1;i<kernelSize;++i){
-			result+=texture(image,TexCoords+vec2(tex_offset.x*i,0.0)).rgb*weight[i];
-			result+=texture(image,TexCoords-vec2(tex_offset.x*i,0.0)).rgb*weight[i];
-		}
+	vec2 direction=horizontal ? vec2(tex_offset.x,0.0) : vec2(0.0,tex_offset.y);
+	// all four channels are convolved: the target's format decides which are kept, and premultiplied alpha blurs like colour
+	vec4 result=vec4(0.0);
+	for(int i=0;i<tapCount;++i){
+		vec2 tap=texelFetch(taps,i,0).xy;
+		result+=texture(image,TexCoords+direction*tap.x)*tap.y;
 	}
-	else{
-		for(int i=1;i<kernelSize;++i){
-			result+=texture(image,TexCoords+vec2(0.0,tex_offset.y*i)).rgb*weight[i];
-			result+=texture(image,TexCoords-vec2(0.0,tex_offset.y*i)).rgb*weight[i];
-		}
-	}
-	FragColor = vec4(result,1.0);
+	FragColor = result;
 }
\ No newline at end of file
@@ -7,18 +7,99 @@
 #include <learnopengl/filesystem.h>
 #include <learnopengl/shader_s.h>
 
+#include "mappedFile.h"
+#include "blurWork.h"
+#ifdef __linux__
+#include "blurProtocol.h"
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <csignal>
+#include <cerrno>
+#endif
+
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <vector>
+#include <map>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <climits>
+#include <iomanip>
+#include <tuple>
+
+//64 bit file offsets, needed for images over 2GB
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
 
 //Function declarations, otherwise the compiler won't know about functions below a given function
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow* window);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void window_refresh_callback(GLFWwindow* window);
+bool pipelineChanged();
 void simpleBlurTexture(GLuint input, GLuint& output);
 void halfTextureSize(GLuint input, GLuint& output);
 void fastBlurTexture(GLuint input, GLuint& output);
 void calculateKernel(int size);
+std::vector<float> efficientKernel(int size);
+struct separableKernel;
+class textureData;
+separableKernel mirroredKernel(const std::vector<float>& halfKernel);
+void normalizeKernel(separableKernel& kernel);
+void applyKernelType();
+void separableConvolve(GLuint input, GLuint output, const separableKernel& kernel, int iterations);
+void separableConvolveCPU(std::vector<float>& pixels, int width, int height, const separableKernel& kernel, int iterations);
+void wideBlurTexture(GLuint input, GLuint output);
+void multiRadiusTexture(GLuint input, GLuint output);
+void allocateMultiRadiusOutputs();
+void blurStage(void (*stage)(GLuint, GLuint&), GLuint input, GLuint& output);
+void flatStage(void (*stage)(GLuint, GLuint&), GLuint input, GLuint& output);
+void releaseTemporalState();
+void releaseFlatState();
+separableKernel gaussianKernel(float sigma, int radius);
 void renderQuad();
+struct blurPlan;
+void loadBlurPlans();
+void applyAutoPlan();
+void recordFrame(double frameTime, double cpuTime, double swapTime);
+void initTrace();
+int beginTrace(const char* name);
+void endTrace(int slot);
+bool dumpTrace(const std::string& path);
+size_t textureBytes(int width, int height, bool mipmaps, int channels = 4);
+size_t stageTextureBytes();
+int stageChannels();
+GLenum channelFormat(int channels);
+void setChannelSwizzle(GLuint texture, int channels);
+void applySourceSwizzle(const textureData& text);
+void bindDisplayTexture(GLuint texture);
+void restoreDisplayTexture();
+void premultiplyAlpha(unsigned char* data, int width, int height, int channels);
+void trackTexture(GLuint texture, const std::string& name, size_t bytes);
+void untrackTexture(GLuint texture);
+bool makeTextureRoom(size_t bytes);
+void reportTextureMemory();
+glm::vec2 sourceSize();
+const unsigned char* readImageCache(const std::string& path, mappedFile& mapping, int& width, int& height, int& channels);
+void writeImageCache(const std::string& path, const unsigned char* data, int width, int height, int channels);
+bool blurTiled(const std::string& inputPath, const std::string& outputPath);
+int runBlurDaemon(const char* socketPath);
 
 //Class to store information about a given texture
 class textureData
@@ -29,10 +110,16 @@ public:
 	GLuint m_handle = -1;
 	glm::vec2 m_size = glm::vec2(0, 0);
 	int m_channels = 0;
+	//glfwGetTime() when last selected, used to evict the least recently used sources
+	double m_lastUsed = 0;
+	//Set when the file couldn't be decoded or didn't fit in the budget, so it isn't retried every frame
+	bool m_loadFailed = false;
 };
 
 //currently selected texture index
 unsigned int textureNum = 0;
+//Texture useTexture was last called with
+unsigned int usedTextureNum = -1;
 
 //vector of textures to swap through. Will have to change paths to reflect your files
 std::vector<textureData> textures = { textureData("resources/textures/container.jpg"),textureData("resources/textures/matrix.jpg") ,textureData("resources/textures/screenshot3.png") };
@@ -48,64 +135,295 @@ bool halfDirty = true;
 bool fastBlur = false;
 bool fastBlurPressed = false;
 bool fastBlurDirty = true;
+//When set, the blur stages are chosen by the auto tuner instead of the B/F/H keys
+bool autoPlan = false;
+bool autoPlanPressed = false;
+//Texture the current auto plan was chosen for, -1 forces a new lookup
+int autoPlanTexture = -1;
+
+//Events that happened during the current frame, used to explain frame time spikes
+enum frameEvent
+{
+	FRAME_REALLOCATION = 1,
+	FRAME_SHADER_COMPILE = 2,
+	FRAME_TUNE = 4
+};
+unsigned int frameEvents = 0;
+//Frame time statistics are reported every frameStatsWindow frames. A frame taking stallFactor
+//times the previous window's median is reported as a stall. Until the first window completes the median
+//of the first stallSeedFrames frames is used, so stalls at startup such as the shader compile are reported too
+int frameStatsWindow = 300;
+float stallFactor = 2.0f;
+int stallSeedFrames = 30;
+
+//Tiled mode processes images tileSize x tileSize at a time, so images larger than GL_MAX_TEXTURE_SIZE or
+//device memory can be blurred
+int tileSize = 2048;
+//Set while the stages work on something other than the selected texture (a tile, or a daemon client's frame).
+//They are then sized from externalInputSize
+bool externalInput = false;
+glm::vec2 externalInputSize = glm::vec2(0, 0);
+
+//Channels the blur stages output: 1 (mask), 2, 3 or 4 (premultiplied RGBA). 0 matches the selected source.
+//Intermediates use the matching format, so a mask blur moves a quarter of the bytes of an RGBA one
+int blurChannels = 0;
+bool blurChannelsPressed = false;
+
+//Number of horizontal + vertical pass pairs performed by the blur stages
+int blurIterations = 5;
+//Most iterations a tuned plan or a daemon request may use
+const int maxBlurIterations = 100;
+//Size last passed to calculateKernel
+int kernelSize = 7;
 
 //vector of floats representing a 1 dimensional convolution kernel. Doesn't store reduntant (symmetrical) values
 std::vector<float> kernel1DEfficient;
 
+//A 1D kernel of any length for separable convolution. m_weights[i] applies to the texel at offset i - m_centre,
+//so kernels don't have to be symmetric
+struct separableKernel
+{
+	std::vector<float> m_weights;
+	int m_centre = 0;
+};
+//Kernel the simple blur convolves with. calculateKernel sets it to the mirrored kernel1DEfficient
+separableKernel blurKernel;
+//Filters K cycles through for the simple blur
+enum kernelTypes
+{
+	KERNEL_GAUSSIAN,
+	KERNEL_BOX,
+	KERNEL_TENT,
+	KERNEL_LANCZOS,
+	KERNEL_TYPE_COUNT
+};
+int kernelType = KERNEL_GAUSSIAN;
+bool kernelTypePressed = false;
+//Whether adjacent taps are merged into single linear fetches where their weights allow
+bool mergeTaps = true;
+//Wide blur replaces the simple blur's kernel and iterations with one gaussian of wideBlurSigma source pixels,
+//done through the FFT once its radius passes the crossover measured for the resolution
+bool wideBlur = false;
+bool wideBlurPressed = false;
+bool wideSigmaPressed = false;
+float wideBlurSigma = 64.0f;
+//Multi-radius mode replaces the simple blur with the average of gaussians of each of multiRadiusSigmas source pixels,
+//like a bloom. libblurwork chains the radii, so each one only pays for its increase over the previous one
+bool multiRadius = false;
+bool multiRadiusPressed = false;
+std::vector<float> multiRadiusSigmas = { 2.0f, 4.0f, 8.0f, 16.0f };
+//one stage sized texture per radius
+std::vector<GLuint> multiRadiusOutputs;
+//Temporal mode re-blurs only the blocks of the blur input that changed since the previous frame, plus the
+//blur's apron, and keeps the previous output everywhere else
+bool temporal = false;
+bool temporalPressed = false;
+int temporalBlockSize = 32;
+//A block counts as changed when any channel differs by more than this (0-255)
+int temporalThreshold = 2;
+//Above this fraction of changed blocks everything is re-blurred, as is every temporalRefreshInterval frames
+float temporalFullFraction = 0.5f;
+int temporalRefreshInterval = 120;
+//Flat tile skipping measures the range of values in each flatTileSize tile of the blur input. A normalized blur
+//leaves a tile unchanged when the tiles within its apron all hold the same value, so those are copied instead of blurred
+bool flatSkip = false;
+bool flatSkipPressed = false;
+int flatTileSize = 32;
+//A neighbourhood is flat when no channel's range is more than this (0-255). At 0 the output is unchanged
+int flatThreshold = 0;
+
 //Framebuffer used to capture resulting images
 GLuint fb;
 //Because blur operations are done separately in each dimension, a working texture is needed to capture
 //the middle state. input->blurWorkingTexture->output
 GLuint blurWorkingTexture = 0;
 
+//The blur, fast blur and half passes, which live in libblurwork (blurWork.cpp)
+blurWorkContext* blurLibrary = nullptr;
+
 //Shader objects for the new shaders created. Note: I added a default constructor to the shader class
 //to allow this usage
-Shader simpleBlurShader;
-Shader halfShader;
-Shader fastBlurShader;
+Shader blockDiffShader;
+Shader copyShader;
+Shader tileRangeShader;
+
+//Every texture the pipeline allocates and its size in bytes, so GPU memory use can be reported and
+//kept within textureBudget
+struct trackedTexture
+{
+	std::string m_name;
+	size_t m_bytes;
+};
+std::map<GLuint, trackedTexture> trackedTextures;
+size_t trackedBytes = 0;
+//Least recently used sources are evicted to keep allocations under this many bytes
+size_t textureBudget = size_t(512) * 1024 * 1024;
+//Only level 0 of the sources is ever sampled, so their mip chains are skipped unless this is set
+bool sourceMipmaps = false;
+bool memoryReportPressed = false;
+
+//On-demand mode (O) sleeps in glfwWaitEvents until a key, resize or expose event sets redrawNeeded, and then
+//only reruns the stages if something they depend on changed. Otherwise the cached output is presented again
+bool onDemand = false;
+bool onDemandPressed = false;
+bool redrawNeeded = true;
+
+//G captures the libblurwork calls of the next captureFrames frames to capturePath, for replaying with blurReplay.
+//With captureFrames at 0 the capture runs until G is pressed again
+bool capturing = false;
+bool capturePressed = false;
+int captureFrames = 1;
+int capturedFrames = 0;
+std::string capturePath = "capture.bwc";
+
+//Timeline tracing. Each traceScope pushes a KHR_debug group, so GPU debuggers show the same stage names, and records
+//its CPU start and end along with GPU timestamp queries into a ring of traceCapacity events. P writes the ring to
+//tracePath as Chrome trace JSON (chrome://tracing or ui.perfetto.dev), with the CPU and GPU as two threads
+struct traceEvent
+{
+	const char* m_name = nullptr;
+	//microseconds since traceStart. m_cpuEnd is negative while the scope is open
+	double m_cpuStart = 0;
+	double m_cpuEnd = -1;
+	GLuint m_queries[2] = { 0, 0 };
+	//GPU start and end moved onto the CPU clock, valid once m_resolved
+	double m_gpuStart = 0;
+	double m_gpuEnd = 0;
+	bool m_resolved = true;
+};
+const int traceCapacity = 4096;
+std::vector<traceEvent> traceEvents;
+//Number of events begun so far. The next one goes in slot traceCount % traceCapacity
+size_t traceCount = 0;
+std::chrono::steady_clock::time_point traceStart;
+//GPU timestamp minus CPU time in microseconds, measured when tracing starts
+double traceGPUOffset = 0;
+std::string tracePath = "trace.json";
+bool tracePressed = false;
+//KHR_debug isn't part of 3.3 core so its functions are looked up directly rather than through glad, and are null without it
+typedef void (APIENTRY* pushDebugGroupFunction)(GLenum source, GLuint id, GLsizei length, const char* message);
+typedef void (APIENTRY* popDebugGroupFunction)();
+pushDebugGroupFunction pushDebugGroup = nullptr;
+popDebugGroupFunction popDebugGroup = nullptr;
+#ifndef GL_DEBUG_SOURCE_APPLICATION
+#define GL_DEBUG_SOURCE_APPLICATION 0x824A
+#endif
+
+//Traces the enclosing block
+class traceScope
+{
+public:
+	traceScope(const char* name) { m_slot = beginTrace(name); }
+	~traceScope() { endTrace(m_slot); }
+	traceScope(const traceScope&) = delete;
+	traceScope& operator=(const traceScope&) = delete;
+private:
+	int m_slot;
+};
 
 // settings
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
 
-//Iterates through over textures loading files and setting member data
+//Loads a file into a texture and sets member data, evicting other sources first if it wouldn't fit in the budget.
+//Decoded pixels come from the image cache when it's up to date, otherwise the file is decoded and cached
+void loadTexture(textureData& text) {
+	int width;
+	int height;
+	// The FileSystem::getPath(...) is part of the GitHub repository so we can find files on any IDE/platform; replace it with your own image path.
+	std::string path = FileSystem::getPath(text.m_filepath);
+	mappedFile cached;
+	unsigned char* decoded = nullptr;
+	int decodeTrace = beginTrace("decode");
+	//cache entries are already premultiplied, so a warm start uploads straight from the mapping
+	const unsigned char* data = readImageCache(path, cached, width, height, text.m_channels);
+	if (!data) {
+		decoded = stbi_load(path.c_str(), &width, &height, &text.m_channels, 0);
+		data = decoded;
+		if (decoded) {
+			premultiplyAlpha(decoded, width, height, text.m_channels);
+			writeImageCache(path, decoded, width, height, text.m_channels);
+		}
+	}
+	//the handle stays -1 when the image can't be loaded, so nothing is allocated or tracked for it
+	bool fits = data && makeTextureRoom(textureBytes(width, height, sourceMipmaps, text.m_channels));
+	endTrace(decodeTrace);
+	if (!fits) {
+		std::cout << (data ? "Not enough texture memory for " : "Failed to load texture ") << text.m_filepath << std::endl;
+		text.m_loadFailed = true;
+		stbi_image_free(decoded);
+		return;
+	}
+	traceScope uploadTrace("upload");
+	glGenTextures(1, &text.m_handle);
+	glBindTexture(GL_TEXTURE_2D, text.m_handle); // all upcoming GL_TEXTURE_2D operations now have effect on this texture object
+	// set the texture wrapping parameters. GL_CLAMP isn't part of the core profile, so clamp to edge is used
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// create texture. Only level 0 is ever sampled so mipmaps are only generated if asked for
+	text.m_size = glm::vec2(width, height);
+	//rows are tightly packed, which for RGB isn't the default 4 byte alignment
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	//allocate the format matching the number of channels, so masks and grey+alpha images aren't padded to RGBA
+	if (text.m_channels == 1) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, text.m_size.x, text.m_size.y, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+	}
+	else if (text.m_channels == 2) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, text.m_size.x, text.m_size.y, 0, GL_RG, GL_UNSIGNED_BYTE, data);
+	}
+	else if (text.m_channels == 3) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, text.m_size.x, text.m_size.y, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+	}
+	else if (text.m_channels == 4) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, text.m_size.x, text.m_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	}
+	if (sourceMipmaps) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	applySourceSwizzle(text);
+	trackTexture(text.m_handle, text.m_filepath, textureBytes(width, height, sourceMipmaps, text.m_channels));
+	//Free image data from CPU side after GPU resource has been allocated. A cached mapping is released when it goes out of scope
+	stbi_image_free(decoded);
+}
+
+void unloadTexture(textureData& text) {
+	untrackTexture(text.m_handle);
+	glDeleteTextures(1, &text.m_handle);
+	text.m_handle = -1;
+}
+
+//Makes sure a source is loaded and marks it as most recently used. A source that failed to load is tried
+//again when it's next selected, as other sources may have been evicted by then
+void useTexture(unsigned int index) {
+	if (index != usedTextureNum) {
+		textures[index].m_loadFailed = false;
+		usedTextureNum = index;
+	}
+	if (textures[index].m_handle == GLuint(-1) && !textures[index].m_loadFailed) {
+		loadTexture(textures[index]);
+	}
+	textures[index].m_lastUsed = glfwGetTime();
+}
+
+//Iterates through over textures loading those that fit in the budget. The rest are loaded when selected
 void loadTextures() {
 	int width;
 	int height;
+	int channels;
 	for (textureData& text : textures) {
-		glGenTextures(1, &text.m_handle);
-		glBindTexture(GL_TEXTURE_2D, text.m_handle); // all upcoming GL_TEXTURE_2D operations now have effect on this texture object
-		// set the texture wrapping parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-		// set texture filtering parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		// load image, create texture and generate mipmaps
-		// The FileSystem::getPath(...) is part of the GitHub repository so we can find files on any IDE/platform; replace it with your own image path.
-		unsigned char* data = stbi_load(FileSystem::getPath(text.m_filepath).c_str(), &width, &height, &text.m_channels, 0);
-		if (data)
-		{
-			text.m_size = glm::vec2(width, height);
-			//depending on number of channels allocate RGB or RGBA. Could be expanded for more encodings too
-			if (text.m_channels == 3) {
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, text.m_size.x, text.m_size.y, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			}
-			else if (text.m_channels == 4) {
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, text.m_size.x, text.m_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-			}
-			glGenerateMipmap(GL_TEXTURE_2D);
-		}
-		else
-		{
-			std::cout << "Failed to load texture" << std::endl;
+		if (stbi_info(FileSystem::getPath(text.m_filepath).c_str(), &width, &height, &channels)
+			&& trackedBytes + textureBytes(width, height, sourceMipmaps, channels) > textureBudget) {
+			continue;
 		}
-		//Free image data from CPU side after GPU resource has been allocated
-		stbi_image_free(data);
+		loadTexture(text);
 	}
+	reportTextureMemory();
 }
 
-int main()
+int main(int argc, char** argv)
 {
 	// glfw: initialize and configure
 	// ------------------------------
@@ -117,6 +435,11 @@ int main()
 #ifdef __APPLE__
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
+	//the daemon only needs the context
+	bool daemon = argc > 1 && std::string(argv[1]) == "--daemon";
+	if (daemon) {
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	}
 
 	// glfw window creation
 	// --------------------
@@ -129,6 +452,8 @@ int main()
 	}
 	glfwMakeContextCurrent(window);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	glfwSetKeyCallback(window, key_callback);
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
 	// glad: load all OpenGL function pointers
 	// ---------------------------------------
@@ -137,13 +462,25 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	initTrace();
 
 	// build and compile our shaders. Note: you will have to adjust your pathes to match your machine and files
 	// ------------------------------------
-	simpleBlurShader = Shader("C:\\Users\\John\\Desktop\\simpleBlur.vs", "C:\\Users\\John\\Desktop\\simpleBlur.fs");
-	fastBlurShader = Shader("C:\\Users\\John\\Desktop\\fastBlur.vs", "C:\\Users\\John\\Desktop\\fastBlur.fs");
-	halfShader = Shader("C:\\Users\\John\\Desktop\\half.vs", "C:\\Users\\John\\Desktop\\half.fs");
+	double compileStart = glfwGetTime();
+	//glad is already loaded and the library is linked into this executable, so it doesn't need a loader
+	blurLibrary = blurWorkCreate("C:\\Users\\John\\Desktop\\", NULL);
+	if (!blurLibrary)
+	{
+		std::cout << "Failed to build the blur shaders" << std::endl;
+		return -1;
+	}
+	blockDiffShader = Shader("C:\\Users\\John\\Desktop\\half.vs", "C:\\Users\\John\\Desktop\\blockDiff.fs");
+	copyShader = Shader("C:\\Users\\John\\Desktop\\half.vs", "C:\\Users\\John\\Desktop\\copy.fs");
+	tileRangeShader = Shader("C:\\Users\\John\\Desktop\\half.vs", "C:\\Users\\John\\Desktop\\tileRange.fs");
 	Shader ourShader("4.1.texture.vs", "4.1.texture.fs");
+	std::cout << "Shader compile: " << (glfwGetTime() - compileStart) * 1000 << "ms" << std::endl;
+	//drivers often finish compiling on first use, so the first frame is attributed to it
+	frameEvents |= FRAME_SHADER_COMPILE;
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
@@ -186,6 +523,35 @@ int main()
 	loadTextures();
 	//Generate the kernel data. Size is adjustable. This could also be call dynamically if you want to adjust the size
 	calculateKernel(7);
+	//Read any plans the auto tuner persisted on previous runs
+	loadBlurPlans();
+	//"--tune" tunes every texture offline, persists the plans and exits
+	if (argc > 1 && std::string(argv[1]) == "--tune") {
+		for (textureNum = 0; textureNum < textures.size(); textureNum++) {
+			useTexture(textureNum);
+			if (textures[textureNum].m_handle == GLuint(-1)) {
+				std::cout << "Skipping " << textures[textureNum].m_filepath << " as it didn't load" << std::endl;
+				continue;
+			}
+			applyAutoPlan();
+		}
+		glfwTerminate();
+		return 0;
+	}
+	//"--tile input output [fast]" blurs an image of any size a tile at a time into a binary PPM and exits
+	if (argc > 3 && std::string(argv[1]) == "--tile") {
+		fastBlur = argc > 4 && std::string(argv[4]) == "fast";
+		blur = !fastBlur;
+		bool success = blurTiled(argv[2], argv[3]);
+		glfwTerminate();
+		return success ? 0 : -1;
+	}
+	//"--daemon [socket]" serves blur requests from other processes until killed
+	if (daemon) {
+		int result = runBlurDaemon(argc > 2 ? argv[2] : nullptr);
+		glfwTerminate();
+		return result;
+	}
 
 	//Textures to capture the blur and half results
 	GLuint output = 0;
@@ -199,15 +565,45 @@ int main()
 	// -----------
 	while (!glfwWindowShouldClose(window))
 	{
+		//on-demand mode sleeps here until something needs drawing, traced on its own so it isn't counted as frame time
+		if (onDemand) {
+			traceScope idleTrace("idle");
+			while (!redrawNeeded && !glfwWindowShouldClose(window)) {
+				glfwWaitEvents();
+			}
+			if (glfwWindowShouldClose(window)) {
+				break;
+			}
+			redrawNeeded = false;
+			//time spent idle isn't part of the next frame
+			time = glfwGetTime();
+		}
+		traceScope frameTrace("frame");
+		double frameStart = glfwGetTime();
 		// input
 		// -----
 		processInput(window);
+		useTexture(textureNum);
+		//Pick (and if necessary tune) the plan for a newly selected texture
+		if (autoPlan && autoPlanTexture != (int)textureNum) {
+			applyAutoPlan();
+		}
+
+		//in on-demand mode the last results are presented again unless their inputs changed
+		bool runStages = !onDemand || pipelineChanged() || capturing;
 
 		//Ugly ifs. Should really just create temp variables to track inputs and outputs of stages
-		if (blur) {
+		//An image that couldn't be loaded or didn't fit in the budget has nothing to show
+		if (textures[textureNum].m_handle == GLuint(-1)) {
+			glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+		else if (blur) {
 			if (half) {
-				halfTextureSize(textures[textureNum].m_handle, halfOutput);
-				simpleBlurTexture(halfOutput, output);
+				if (runStages) {
+					halfTextureSize(textures[textureNum].m_handle, halfOutput);
+					blurStage(simpleBlurTexture, halfOutput, output);
+				}
 
 				// render
 				// ------
@@ -216,7 +612,7 @@ int main()
 
 				// bind Texture
 				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, output);
+				bindDisplayTexture(output);
 
 				glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
@@ -226,7 +622,9 @@ int main()
 				glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 			}
 			else {
-				simpleBlurTexture(textures[textureNum].m_handle, output);
+				if (runStages) {
+					blurStage(simpleBlurTexture, textures[textureNum].m_handle, output);
+				}
 
 				// render
 				// ------
@@ -235,7 +633,7 @@ int main()
 
 				// bind Texture
 				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, output);
+				bindDisplayTexture(output);
 
 				glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
@@ -247,8 +645,10 @@ int main()
 		}
 		else if (fastBlur) {
 			if (half) {
-				halfTextureSize(textures[textureNum].m_handle, halfOutput);
-				fastBlurTexture(halfOutput, output);
+				if (runStages) {
+					halfTextureSize(textures[textureNum].m_handle, halfOutput);
+					blurStage(fastBlurTexture, halfOutput, output);
+				}
 
 				// render
 				// ------
@@ -257,7 +657,7 @@ int main()
 
 				// bind Texture
 				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, output);
+				bindDisplayTexture(output);
 
 				glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
@@ -267,7 +667,9 @@ int main()
 				glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 			}
 			else {
-				fastBlurTexture(textures[textureNum].m_handle, output);
+				if (runStages) {
+					blurStage(fastBlurTexture, textures[textureNum].m_handle, output);
+				}
 
 				// render
 				// ------
@@ -276,7 +678,7 @@ int main()
 
 				// bind Texture
 				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, output);
+				bindDisplayTexture(output);
 
 				glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
@@ -288,7 +690,9 @@ int main()
 		}
 		else {
 			if (half) {
-				halfTextureSize(textures[textureNum].m_handle, halfOutput);
+				if (runStages) {
+					halfTextureSize(textures[textureNum].m_handle, halfOutput);
+				}
 
 				// render
 				// ------
@@ -297,7 +701,7 @@ int main()
 
 				// bind Texture
 				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, halfOutput);
+				bindDisplayTexture(halfOutput);
 
 				glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
@@ -314,7 +718,7 @@ int main()
 
 				// bind Texture
 				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, textures[textureNum].m_handle);
+				bindDisplayTexture(textures[textureNum].m_handle);
 
 				glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
@@ -324,13 +728,27 @@ int main()
 				glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 			}
 		}
+		restoreDisplayTexture();
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 		// -------------------------------------------------------------------------------
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		double swapStart = glfwGetTime();
+		{
+			traceScope swapTrace("swap");
+			glfwSwapBuffers(window);
+		}
+		double swapEnd = glfwGetTime();
 		pastTime = time;
 		time = glfwGetTime();
 		std::cout << "\r" << 1 / (time - pastTime);
+		recordFrame((time - pastTime) * 1000, (swapStart - frameStart) * 1000, (swapEnd - swapStart) * 1000);
+		if (capturing && ++capturedFrames == captureFrames) {
+			blurWorkEndCapture(blurLibrary);
+			capturing = false;
+			std::cout << std::endl << "Captured " << capturedFrames << " frames to " << capturePath << std::endl;
+		}
+		if (!onDemand) {
+			glfwPollEvents();
+		}
 	}
 
 	// optional: de-allocate all resources once they've outlived their purpose:
@@ -342,6 +760,10 @@ int main()
 	glDeleteTextures(1, &blurWorkingTexture);
 	glDeleteTextures(1, &output);
 	glDeleteTextures(1, &halfOutput);
+	for (GLuint level : multiRadiusOutputs) {
+		glDeleteTextures(1, &level);
+	}
+	blurWorkDestroy(blurLibrary);
 
 	for (int i = 0; i < textures.size(); i++) {
 		glDeleteTextures(1, &textures[i].m_handle);
@@ -400,6 +822,7 @@ void processInput(GLFWwindow* window)
 	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) {
 		if (!blurPressed) {
 			blur = !blur;
+			autoPlan = false;
 			fastBlur = false;
 			blurDirty = true;
 			halfDirty = true;
@@ -413,6 +836,7 @@ void processInput(GLFWwindow* window)
 	if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) {
 		if (!halfPressed) {
 			half = !half;
+			autoPlan = false;
 			blurDirty = true;
 			halfDirty = true;
 			fastBlurDirty = true;
@@ -425,6 +849,7 @@ void processInput(GLFWwindow* window)
 	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) {
 		if (!fastBlurPressed) {
 			fastBlur = !fastBlur;
+			autoPlan = false;
 			blur = false;
 			blurDirty = true;
 			halfDirty = true;
@@ -435,6 +860,176 @@ void processInput(GLFWwindow* window)
 	else {
 		fastBlurPressed = false;
 	}
+	//toggle the wide blur, and double or halve its sigma with = and -
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
+		if (!wideBlurPressed) {
+			wideBlur = !wideBlur;
+			blur = true;
+			fastBlur = false;
+			autoPlan = false;
+			blurDirty = true;
+			halfDirty = true;
+			fastBlurDirty = true;
+		}
+		wideBlurPressed = true;
+	}
+	else {
+		wideBlurPressed = false;
+	}
+	if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS) {
+		if (!wideSigmaPressed) {
+			wideBlurSigma = glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS ? wideBlurSigma * 2 : std::max(wideBlurSigma / 2, 1.0f);
+			std::cout << std::endl << "Wide blur sigma: " << wideBlurSigma << std::endl;
+		}
+		wideSigmaPressed = true;
+	}
+	else {
+		wideSigmaPressed = false;
+	}
+	//toggle the multi-radius blur
+	if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
+		if (!multiRadiusPressed) {
+			multiRadius = !multiRadius;
+			blur = true;
+			fastBlur = false;
+			autoPlan = false;
+			blurDirty = true;
+			halfDirty = true;
+			fastBlurDirty = true;
+		}
+		multiRadiusPressed = true;
+	}
+	else {
+		multiRadiusPressed = false;
+	}
+	//toggle skipping flat tiles
+	if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS) {
+		if (!flatSkipPressed) {
+			flatSkip = !flatSkip;
+			if (!flatSkip) {
+				releaseFlatState();
+			}
+			blurDirty = true;
+			halfDirty = true;
+			fastBlurDirty = true;
+		}
+		flatSkipPressed = true;
+	}
+	else {
+		flatSkipPressed = false;
+	}
+	//toggle temporal reuse of the previous frame's blur
+	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
+		if (!temporalPressed) {
+			temporal = !temporal;
+			if (!temporal) {
+				releaseTemporalState();
+			}
+			blurDirty = true;
+			halfDirty = true;
+			fastBlurDirty = true;
+		}
+		temporalPressed = true;
+	}
+	else {
+		temporalPressed = false;
+	}
+	//cycle the filter the simple blur convolves with
+	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS) {
+		if (!kernelTypePressed) {
+			kernelType = (kernelType + 1) % KERNEL_TYPE_COUNT;
+			applyKernelType();
+			blurDirty = true;
+			halfDirty = true;
+			fastBlurDirty = true;
+		}
+		kernelTypePressed = true;
+	}
+	else {
+		kernelTypePressed = false;
+	}
+	//print what textures are allocated
+	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS) {
+		if (!memoryReportPressed) {
+			reportTextureMemory();
+		}
+		memoryReportPressed = true;
+	}
+	else {
+		memoryReportPressed = false;
+	}
+	//cycle the channels the stages output between matching the source, 1, 2, 3 and 4
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+		if (!blurChannelsPressed) {
+			blurChannels = (blurChannels + 1) % 5;
+			for (const textureData& text : textures) {
+				applySourceSwizzle(text);
+			}
+			std::cout << std::endl << "Blur channels: " << (blurChannels == 0 ? std::string("source") : std::to_string(blurChannels)) << std::endl;
+			//plans are tuned per channel count
+			autoPlanTexture = -1;
+			blurDirty = true;
+			halfDirty = true;
+			fastBlurDirty = true;
+		}
+		blurChannelsPressed = true;
+	}
+	else {
+		blurChannelsPressed = false;
+	}
+	//toggle on-demand rendering
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
+		if (!onDemandPressed) {
+			onDemand = !onDemand;
+			std::cout << std::endl << "On-demand rendering " << (onDemand ? "on" : "off") << std::endl;
+		}
+		onDemandPressed = true;
+	}
+	else {
+		onDemandPressed = false;
+	}
+	//start or stop a capture
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+		if (!capturePressed) {
+			if (capturing) {
+				blurWorkEndCapture(blurLibrary);
+				capturing = false;
+				std::cout << std::endl << "Captured " << capturedFrames << " frames to " << capturePath << std::endl;
+			}
+			else if (blurWorkBeginCapture(blurLibrary, capturePath.c_str()) == 0) {
+				capturing = true;
+				capturedFrames = 0;
+			}
+			else {
+				std::cout << std::endl << "Failed to write " << capturePath << std::endl;
+			}
+		}
+		capturePressed = true;
+	}
+	else {
+		capturePressed = false;
+	}
+	//write the trace ring to tracePath
+	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
+		if (!tracePressed) {
+			dumpTrace(tracePath);
+		}
+		tracePressed = true;
+	}
+	else {
+		tracePressed = false;
+	}
+	//toggle the auto tuned plan. Manually toggling any stage turns it back off
+	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
+		if (!autoPlanPressed) {
+			autoPlan = !autoPlan;
+			autoPlanTexture = -1;
+		}
+		autoPlanPressed = true;
+	}
+	else {
+		autoPlanPressed = false;
+	}
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -444,90 +1039,140 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	// make sure the viewport matches the new window dimensions; note that width and 
 	// height will be significantly larger than specified on retina displays.
 	glViewport(0, 0, width, height);
+	redrawNeeded = true;
+}
+
+//Presses, repeats and releases all wake on-demand mode, so processInput sees releases and held keys too
+void key_callback(GLFWwindow*, int, int, int, int)
+{
+	redrawNeeded = true;
+}
+
+//The window was uncovered or otherwise needs its contents again
+void window_refresh_callback(GLFWwindow*)
+{
+	redrawNeeded = true;
+}
+
+//Everything the stages' results depend on
+auto pipelineState() {
+	return std::make_tuple(textureNum, textures[textureNum].m_handle, blur, half, fastBlur, wideBlur, wideBlurSigma, multiRadius,
+		temporal, flatSkip, kernelType, kernelSize, blurIterations, blurChannels, mergeTaps, autoPlan);
+}
+
+//Whether the stages have to run again since the last time this returned true
+bool pipelineChanged() {
+	static bool ran = false;
+	static decltype(pipelineState()) lastRun;
+	if (ran && pipelineState() == lastRun) {
+		return false;
+	}
+	ran = true;
+	lastRun = pipelineState();
+	return true;
 }
 
 //Performs our initial "simple" separable gaussian blur
 //Input is the texture to be blurred and output is where the result is stored
 void simpleBlurTexture(GLuint input, GLuint& output) {
+	traceScope trace("simpleBlurTexture");
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 	//if a change has occurred regenrate the textures
 	if (blurDirty) {
 		//if a texture has already been allocated, free it before proceeding
 		if (output != 0) {
+			untrackTexture(output);
 			glDeleteTextures(1, &output);
 		}
 		if (blurWorkingTexture != 0) {
+			untrackTexture(blurWorkingTexture);
 			glDeleteTextures(1, &blurWorkingTexture);
 		}
+		//without room the stage is skipped until something changes, leaving output 0
+		if (!makeTextureRoom(2 * stageTextureBytes())) {
+			output = 0;
+			blurWorkingTexture = 0;
+			blurDirty = false;
+			return;
+		}
 		glGenTextures(1, &output);
 		glBindTexture(GL_TEXTURE_2D, output);
 		//if half stage is happening then the resolution will be /2
 		if (half) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x/2, textures[textureNum].m_size.y/2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x/2, sourceSize().y/2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		}
 		else {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x, textures[textureNum].m_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x, sourceSize().y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		}
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		// set texture filtering parameters
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		setChannelSwizzle(output, stageChannels());
+		trackTexture(output, "output", stageTextureBytes());
 		glGenTextures(1, &blurWorkingTexture);
 		glBindTexture(GL_TEXTURE_2D, blurWorkingTexture);
 
 		if (half) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x / 2, textures[textureNum].m_size.y / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x / 2, sourceSize().y / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		}
 		else {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x, textures[textureNum].m_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x, sourceSize().y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		}
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		// set texture filtering parameters
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		setChannelSwizzle(blurWorkingTexture, stageChannels());
+		trackTexture(blurWorkingTexture, "blurWorkingTexture", stageTextureBytes());
+		allocateMultiRadiusOutputs();
 		//bind blurworkingTexture to FB colour attachment
 		glBindFramebuffer(GL_FRAMEBUFFER, fb);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurWorkingTexture, 0);
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "Framebuffer not complete!" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		blurDirty = false;
+		frameEvents |= FRAME_REALLOCATION;
+	}
+	if (output == 0) {
+		return;
 	}
 
 	if (half) {
-		glViewport(0, 0, textures[textureNum].m_size.x/2, textures[textureNum].m_size.y/2);
+		glViewport(0, 0, sourceSize().x/2, sourceSize().y/2);
 	}
 	else {
-		glViewport(0, 0, textures[textureNum].m_size.x, textures[textureNum].m_size.y);
+		glViewport(0, 0, sourceSize().x, sourceSize().y);
 	}
 
-	GLuint temp = input;
-	for (int i = 0; i < 5; i++) {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, temp);
-		glBindFramebuffer(GL_FRAMEBUFFER, fb);
-		simpleBlurShader.use();
-		simpleBlurShader.setFloat("kernelSize", kernel1DEfficient.size());
-		glUniform1fv(glGetUniformLocation(simpleBlurShader.ID, "weight"), kernel1DEfficient.size(), &kernel1DEfficient[0]);
-		simpleBlurShader.setBool("horizontal", true);
-		renderQuad();
-
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output, 0);
-		glBindTexture(GL_TEXTURE_2D, blurWorkingTexture);
-		simpleBlurShader.setBool("horizontal", false);
-		renderQuad();
-		temp = output;
+	//the radius textures are left out when they don't fit in the budget, and the plain blur runs instead
+	if (multiRadius && !multiRadiusOutputs.empty()) {
+		multiRadiusTexture(input, output);
+	}
+	else if (wideBlur) {
+		wideBlurTexture(input, output);
+	}
+	else {
+		separableConvolve(input, output, blurKernel, blurIterations);
 	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 //Creates a convolution kernel with the requested size and stores the one dimension
 //version of it in kernel1DEfficient
-//https://stackoverflow.com/questions/8204645/implementing-gaussian-blur-how-to-calculate-convolution-matrix-kernel
 void calculateKernel(int size) {
-	kernel1DEfficient.clear();
+	kernelSize = size;
+	kernel1DEfficient = efficientKernel(size);
+	blurKernel = mirroredKernel(kernel1DEfficient);
+}
+
+//One dimensional version of the size x size gaussian, only storing the centre and one side
+//https://stackoverflow.com/questions/8204645/implementing-gaussian-blur-how-to-calculate-convolution-matrix-kernel
+std::vector<float> efficientKernel(int size) {
+	std::vector<float> halfKernel;
 	double sigma = 1;
 	std::vector<std::vector<float>> kernel(size, std::vector<float>(size, 0));
 	float mean = int(size / 2);
@@ -553,9 +1198,111 @@ void calculateKernel(int size) {
 		}
 		//Only store non repeating values
 		if (x >= (int(size / 2))) {
-			kernel1DEfficient.push_back(result);
+			halfKernel.push_back(result);
 		}
 	}
+	return halfKernel;
+}
+
+//Full kernel from one that only stores the centre and one side, like kernel1DEfficient
+separableKernel mirroredKernel(const std::vector<float>& halfKernel) {
+	separableKernel kernel;
+	kernel.m_centre = int(halfKernel.size()) - 1;
+	for (int i = kernel.m_centre; i > 0; i--) {
+		kernel.m_weights.push_back(halfKernel[i]);
+	}
+	kernel.m_weights.insert(kernel.m_weights.end(), halfKernel.begin(), halfKernel.end());
+	return kernel;
+}
+
+//Sampled gaussian covering +-radius, normalized
+separableKernel gaussianKernel(float sigma, int radius) {
+	separableKernel kernel;
+	kernel.m_centre = radius;
+	for (int i = -radius; i <= radius; i++) {
+		kernel.m_weights.push_back(exp(-0.5f * i * i / (sigma * sigma)));
+	}
+	normalizeKernel(kernel);
+	return kernel;
+}
+
+separableKernel boxKernel(int radius) {
+	separableKernel kernel;
+	kernel.m_centre = radius;
+	kernel.m_weights.assign(2 * radius + 1, 1.0f);
+	normalizeKernel(kernel);
+	return kernel;
+}
+
+separableKernel tentKernel(int radius) {
+	separableKernel kernel;
+	kernel.m_centre = radius;
+	for (int i = -radius; i <= radius; i++) {
+		kernel.m_weights.push_back(float(radius + 1 - abs(i)));
+	}
+	normalizeKernel(kernel);
+	return kernel;
+}
+
+//Two lobe lanczos window stretched over +-radius. Has negative weights, so some taps can't be merged
+separableKernel lanczosKernel(int radius) {
+	separableKernel kernel;
+	kernel.m_centre = radius;
+	for (int i = -radius; i <= radius; i++) {
+		double x = 2.0 * i / (radius + 1);
+		double px = glm::pi<double>() * x;
+		kernel.m_weights.push_back(i == 0 ? 1.0f : float(2 * sin(px) * sin(px / 2) / (px * px)));
+	}
+	normalizeKernel(kernel);
+	return kernel;
+}
+
+void normalizeKernel(separableKernel& kernel) {
+	float sum = 0;
+	for (float weight : kernel.m_weights) {
+		sum += weight;
+	}
+	for (float& weight : kernel.m_weights) {
+		weight /= sum;
+	}
+}
+
+//Sets blurKernel to the selected type with the current kernel size
+void applyKernelType() {
+	int radius = kernelSize / 2;
+	switch (kernelType) {
+	case KERNEL_GAUSSIAN:
+		calculateKernel(kernelSize);
+		break;
+	case KERNEL_BOX:
+		blurKernel = boxKernel(radius);
+		break;
+	case KERNEL_TENT:
+		blurKernel = tentKernel(radius);
+		break;
+	case KERNEL_LANCZOS:
+		blurKernel = lanczosKernel(radius);
+		break;
+	}
+}
+
+//Runs iterations of a separable convolution with any kernel: horizontal from the input into blurWorkingTexture,
+//then vertical into output, through libblurwork. The taps are stored in a 1D texture, so the kernel length
+//is only limited by GL_MAX_TEXTURE_SIZE
+void separableConvolve(GLuint input, GLuint output, const separableKernel& kernel, int iterations) {
+	traceScope trace("separableConvolve");
+	blurWorkSetKernel(blurLibrary, &kernel.m_weights[0], int(kernel.m_weights.size()), kernel.m_centre);
+	blurWorkSetIterations(blurLibrary, iterations);
+	blurWorkSetMergeTaps(blurLibrary, mergeTaps);
+	blurWorkSetStage(blurLibrary, BLURWORK_SIMPLE);
+	blurWorkSetWorkingTexture(blurLibrary, blurWorkingTexture);
+	blurWorkBlurTexture(blurLibrary, input, output);
+}
+
+//CPU version of separableConvolve on RGBA float pixels, with the same clamp to edge addressing and
+//ping-pong through a working buffer. Uses the unmerged weights, so it's exact
+void separableConvolveCPU(std::vector<float>& pixels, int width, int height, const separableKernel& kernel, int iterations) {
+	blurWorkConvolveCPU(&pixels[0], width, height, width * 4, 4, &kernel.m_weights[0], int(kernel.m_weights.size()), kernel.m_centre, iterations);
 }
 
 //Performs a draw call of a simple quad
@@ -591,105 +1338,1958 @@ void renderQuad()
 //Halves the size of a texture
 //Input is the texture to be halved and output is where the result is stored
 void halfTextureSize(GLuint input, GLuint& output) {
+	traceScope trace("halfTextureSize");
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 	if (halfDirty) {
 		if (output != 0) {
+			untrackTexture(output);
 			glDeleteTextures(1, &output);
 		}
+		if (!makeTextureRoom(textureBytes(sourceSize().x / 2, sourceSize().y / 2, false, stageChannels()))) {
+			output = 0;
+			halfDirty = false;
+			return;
+		}
 		glGenTextures(1, &output);
 		glBindTexture(GL_TEXTURE_2D, output);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x / 2, textures[textureNum].m_size.y / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x / 2, sourceSize().y / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		// set texture filtering parameters
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		setChannelSwizzle(output, stageChannels());
+		trackTexture(output, "halfOutput", textureBytes(sourceSize().x / 2, sourceSize().y / 2, false, stageChannels()));
 		glBindFramebuffer(GL_FRAMEBUFFER, fb);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output, 0);
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "Framebuffer not complete!" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		halfDirty = false;
+		frameEvents |= FRAME_REALLOCATION;
+	}
+	if (output == 0) {
+		return;
 	}
 
-	glViewport(0, 0, textures[textureNum].m_size.x / 2, textures[textureNum].m_size.y / 2);
+	glViewport(0, 0, sourceSize().x / 2, sourceSize().y / 2);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, input);
-	glBindFramebuffer(GL_FRAMEBUFFER, fb);
-	halfShader.use();
-	renderQuad();
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	blurWorkHalf(blurLibrary, input, output);
 }
 
 //Performs our more efficient hardware interpolated separable gaussian blur
 //Input is the texture to be blurred and output is where the result is stored
 void fastBlurTexture(GLuint input, GLuint& output) {
+	traceScope trace("fastBlurTexture");
 
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 	if (fastBlurDirty) {
 		if (output != 0) {
+			untrackTexture(output);
 			glDeleteTextures(1, &output);
 		}
 		if (blurWorkingTexture != 0) {
+			untrackTexture(blurWorkingTexture);
 			glDeleteTextures(1, &blurWorkingTexture);
 		}
+		if (!makeTextureRoom(2 * stageTextureBytes())) {
+			output = 0;
+			blurWorkingTexture = 0;
+			fastBlurDirty = false;
+			return;
+		}
 		glGenTextures(1, &output);
 		glBindTexture(GL_TEXTURE_2D, output);
 		if (half) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x / 2, textures[textureNum].m_size.y / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x / 2, sourceSize().y / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		}
 		else {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x, textures[textureNum].m_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x, sourceSize().y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		}
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		// set texture filtering parameters
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		setChannelSwizzle(output, stageChannels());
+		trackTexture(output, "output", stageTextureBytes());
 		glGenTextures(1, &blurWorkingTexture);
 		glBindTexture(GL_TEXTURE_2D, blurWorkingTexture);
 
 		if (half) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x / 2, textures[textureNum].m_size.y / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x / 2, sourceSize().y / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		}
 		else {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[textureNum].m_size.x, textures[textureNum].m_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), sourceSize().x, sourceSize().y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		}
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		// set texture filtering parameters
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		setChannelSwizzle(blurWorkingTexture, stageChannels());
+		trackTexture(blurWorkingTexture, "blurWorkingTexture", stageTextureBytes());
 		glBindFramebuffer(GL_FRAMEBUFFER, fb);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurWorkingTexture, 0);
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "Framebuffer not complete!" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		fastBlurDirty = false;
+		frameEvents |= FRAME_REALLOCATION;
+	}
+	if (output == 0) {
+		return;
 	}
 
 	if (half) {
-		glViewport(0, 0, textures[textureNum].m_size.x / 2, textures[textureNum].m_size.y / 2);
+		glViewport(0, 0, sourceSize().x / 2, sourceSize().y / 2);
 	}
 	else {
-		glViewport(0, 0, textures[textureNum].m_size.x, textures[textureNum].m_size.y);
+		glViewport(0, 0, sourceSize().x, sourceSize().y);
 	}
 
-	GLuint temp = input;
-	for (int i = 0; i < 5; i++) {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, temp);
-		glBindFramebuffer(GL_FRAMEBUFFER, fb);
-		fastBlurShader.use();
-		fastBlurShader.setBool("horizontal", true);
-		renderQuad();
+	blurWorkSetIterations(blurLibrary, blurIterations);
+	blurWorkSetStage(blurLibrary, BLURWORK_FAST);
+	blurWorkSetWorkingTexture(blurLibrary, blurWorkingTexture);
+	blurWorkBlurTexture(blurLibrary, input, output);
+}
 
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output, 0);
-		glBindTexture(GL_TEXTURE_2D, blurWorkingTexture);
-		fastBlurShader.setBool("horizontal", false);
-		renderQuad();
-		temp = output;
+//Blur configuration the auto tuner chooses between
+struct blurPlan
+{
+	bool fast = false;
+	bool half = false;
+	int kernelSize = 7;
+	int iterations = 5;
+};
+
+//Quality budget for the auto tuner: the effective gaussian sigma we want (in source pixels) and
+//how far the result may be from an exact gaussian. Errors are measured on a 0-255 scale
+float tuneSigma = 4.0f;
+float tuneMinPSNR = 35.0f;
+float tuneMaxAbsError = 16.0f;
+//Number of timed runs averaged per candidate
+int tuneRuns = 10;
+//File the winning plans are persisted to, one per line
+const char* blurPlanPath = "blurPlans.txt";
+//Winning plans keyed by resolution, stage channels, sigma and device
+std::map<std::string, blurPlan> blurPlans;
+
+//Copy of gWeights2 and gOffsets2 from fastBlur.fs, needed to work out the sigma the fast blur produces
+const float fastBlurWeights[2] = { 0.44908f, 0.05092f };
+const float fastBlurOffsets[2] = { 0.53805f, 2.06278f };
+
+//Key a plan is stored under
+std::string blurPlanKey(int width, int height, int channels, float sigma, const std::string& renderer) {
+	std::stringstream key;
+	key << width << " " << height << " " << channels << " " << sigma << " " << renderer;
+	return key.str();
+}
+
+//Each line is "fast half kernelSize iterations" followed by the key
+void loadBlurPlans() {
+	std::ifstream file(blurPlanPath);
+	std::string line;
+	while (std::getline(file, line)) {
+		std::stringstream stream(line);
+		blurPlan plan;
+		std::string key;
+		if (stream >> plan.fast >> plan.half >> plan.kernelSize >> plan.iterations && std::getline(stream >> std::ws, key)) {
+			blurPlans[key] = plan;
+		}
 	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
\ No newline at end of file
+}
+
+void saveBlurPlans() {
+	std::ofstream file(blurPlanPath);
+	for (const auto& entry : blurPlans) {
+		const blurPlan& plan = entry.second;
+		file << plan.fast << " " << plan.half << " " << plan.kernelSize << " " << plan.iterations << " " << entry.first << std::endl;
+	}
+}
+
+//Variance (in pixels squared) one pass of the simple blur adds with a kernel stored like kernel1DEfficient
+float simpleBlurPassVariance(const std::vector<float>& halfKernel) {
+	float variance = 0;
+	for (int i = 1; i < int(halfKernel.size()); i++) {
+		variance += 2 * halfKernel[i] * i * i;
+	}
+	return variance;
+}
+
+//Variance one pass of the fast blur adds. Each tap is a linear fetch that splits its weight between two texels
+float fastBlurPassVariance() {
+	float variance = 0;
+	for (int i = 0; i < 2; i++) {
+		float texel = floor(fastBlurOffsets[i]);
+		float fraction = fastBlurOffsets[i] - texel;
+		variance += 2 * fastBlurWeights[i] * ((1 - fraction) * texel * texel + fraction * (texel + 1) * (texel + 1));
+	}
+	return variance;
+}
+
+//Generates one candidate per stage/kernel combination with the iteration count closest to the requested sigma.
+//The half stage is a small box filter (variance 0.75) and doubles the size of everything after it
+std::vector<blurPlan> candidateBlurPlans(float sigma) {
+	std::vector<blurPlan> candidates;
+	for (int fast = 0; fast < 2; fast++) {
+		for (int halfStage = 0; halfStage < 2; halfStage++) {
+			//the fast shader has a fixed kernel so only one size needs trying
+			int maxSize = fast ? 3 : 11;
+			for (int size = 3; size <= maxSize; size += 2) {
+				float passVariance = fast ? fastBlurPassVariance() : simpleBlurPassVariance(efficientKernel(size));
+				float varianceScale = halfStage ? 4.0f : 1.0f;
+				float prefilter = halfStage ? 0.75f : 0.0f;
+				blurPlan plan;
+				plan.fast = fast;
+				plan.half = halfStage;
+				plan.kernelSize = size;
+				plan.iterations = std::max(1, int(round((sigma * sigma - prefilter) / (varianceScale * passVariance))));
+				float planSigma = sqrt(prefilter + varianceScale * plan.iterations * passVariance);
+				//skip plans that can't get near the requested sigma
+				if (plan.iterations <= maxBlurIterations && fabs(planSigma - sigma) < 0.25f * sigma) {
+					candidates.push_back(plan);
+				}
+			}
+		}
+	}
+	return candidates;
+}
+
+//Sets up the stage globals to perform a plan
+void setBlurPlan(const blurPlan& plan) {
+	blur = !plan.fast;
+	fastBlur = plan.fast;
+	half = plan.half;
+	wideBlur = false;
+	multiRadius = false;
+	kernelType = KERNEL_GAUSSIAN;
+	calculateKernel(plan.kernelSize);
+	blurIterations = plan.iterations;
+	blurDirty = true;
+	halfDirty = true;
+	fastBlurDirty = true;
+}
+
+//Runs the current stages on the selected texture. output holds the result
+void runBlurStages(GLuint& halfOutput, GLuint& output) {
+	GLuint input = textures[textureNum].m_handle;
+	if (half) {
+		halfTextureSize(input, halfOutput);
+		input = halfOutput;
+	}
+	if (fastBlur) {
+		fastBlurTexture(input, output);
+	}
+	else {
+		simpleBlurTexture(input, output);
+	}
+}
+
+//Reads back a texture as RGBA floats in the 0-1 range, as the stages sample it. glGetTexImage ignores the
+//texture's swizzle, which picks what the stages see (a mask can be the source's alpha), so it's applied here
+std::vector<float> readTexture(GLuint texture, int width, int height) {
+	traceScope trace("readTexture");
+	std::vector<float> pixels(size_t(width) * height * 4);
+	if (pixels.empty()) {
+		return pixels;
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &pixels[0]);
+	GLint swizzle[4];
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	if (swizzle[0] == GL_RED && swizzle[1] == GL_GREEN && swizzle[2] == GL_BLUE && swizzle[3] == GL_ALPHA) {
+		return pixels;
+	}
+	for (size_t pixel = 0; pixel < pixels.size(); pixel += 4) {
+		float texel[6] = { pixels[pixel], pixels[pixel + 1], pixels[pixel + 2], pixels[pixel + 3], 0.0f, 1.0f };
+		for (int c = 0; c < 4; c++) {
+			int source = swizzle[c] == GL_RED ? 0 : swizzle[c] == GL_GREEN ? 1 : swizzle[c] == GL_BLUE ? 2 : swizzle[c] == GL_ALPHA ? 3 : swizzle[c] == GL_ZERO ? 4 : 5;
+			pixels[pixel + c] = texel[source];
+		}
+	}
+	return pixels;
+}
+
+//Exact separable gaussian with clamp to edge addressing, the reference the tuner measures error against
+std::vector<float> referenceGaussian(const std::vector<float>& input, int width, int height, float sigma) {
+	std::vector<float> result = input;
+	separableConvolveCPU(result, width, height, gaussianKernel(sigma, int(ceil(4 * sigma))), 1);
+	return result;
+}
+
+//Compares a result against the reference, bilinearly upsampling half resolution results first.
+//Alpha is compared too, as the stages blur it along with the premultiplied colour
+void compareToReference(const std::vector<float>& result, int resultWidth, int resultHeight,
+	const std::vector<float>& reference, int width, int height, float& psnr, float& maxAbsError) {
+	double squaredError = 0;
+	maxAbsError = 0;
+	for (int y = 0; y < height; y++) {
+		float v = std::max((y + 0.5f) * resultHeight / height - 0.5f, 0.0f);
+		int y0 = std::min(int(v), resultHeight - 1);
+		int y1 = std::min(y0 + 1, resultHeight - 1);
+		float fy = v - y0;
+		for (int x = 0; x < width; x++) {
+			float u = std::max((x + 0.5f) * resultWidth / width - 0.5f, 0.0f);
+			int x0 = std::min(int(u), resultWidth - 1);
+			int x1 = std::min(x0 + 1, resultWidth - 1);
+			float fx = u - x0;
+			for (int c = 0; c < 4; c++) {
+				float top = result[(y0 * resultWidth + x0) * 4 + c] * (1 - fx) + result[(y0 * resultWidth + x1) * 4 + c] * fx;
+				float bottom = result[(y1 * resultWidth + x0) * 4 + c] * (1 - fx) + result[(y1 * resultWidth + x1) * 4 + c] * fx;
+				float error = fabs((top * (1 - fy) + bottom * fy) - reference[(y * width + x) * 4 + c]) * 255;
+				squaredError += error * error;
+				maxAbsError = std::max(maxAbsError, error);
+			}
+		}
+	}
+	double mse = squaredError / (double(width) * height * 4);
+	psnr = mse > 0 ? float(10 * log10(255.0 * 255.0 / mse)) : 100.0f;
+}
+
+//Benchmarks every candidate on the selected texture and returns the fastest one within the quality budget.
+//If none meet it the most accurate candidate is returned instead
+blurPlan tuneBlurPlan(float sigma) {
+	int width = textures[textureNum].m_size.x;
+	int height = textures[textureNum].m_size.y;
+	std::vector<float> reference = referenceGaussian(readTexture(textures[textureNum].m_handle, width, height), width, height, sigma);
+
+	GLuint query;
+	glGenQueries(1, &query);
+	GLuint tuneHalfOutput = 0;
+	GLuint tuneOutput = 0;
+	blurPlan fastest;
+	blurPlan mostAccurate;
+	double fastestTime = -1;
+	float bestPSNR = -1;
+	for (const blurPlan& plan : candidateBlurPlans(sigma)) {
+		setBlurPlan(plan);
+		//first run allocates the intermediate textures so isn't timed
+		runBlurStages(tuneHalfOutput, tuneOutput);
+		if (tuneOutput == 0) {
+			std::cout << "Skipping a plan that doesn't fit in the texture budget" << std::endl;
+			continue;
+		}
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		for (int i = 0; i < tuneRuns; i++) {
+			runBlurStages(tuneHalfOutput, tuneOutput);
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		double time = elapsed / 1000000.0 / tuneRuns;
+
+		int resultWidth = plan.half ? width / 2 : width;
+		int resultHeight = plan.half ? height / 2 : height;
+		float psnr;
+		float maxAbsError;
+		compareToReference(readTexture(tuneOutput, resultWidth, resultHeight), resultWidth, resultHeight, reference, width, height, psnr, maxAbsError);
+		std::cout << (plan.fast ? "fast" : "simple") << (plan.half ? " half" : "") << " kernel " << plan.kernelSize << " x" << plan.iterations
+			<< ": " << time << "ms, PSNR " << psnr << ", max error " << maxAbsError << std::endl;
+
+		if (psnr >= tuneMinPSNR && maxAbsError <= tuneMaxAbsError && (fastestTime < 0 || time < fastestTime)) {
+			fastest = plan;
+			fastestTime = time;
+		}
+		if (psnr > bestPSNR) {
+			mostAccurate = plan;
+			bestPSNR = psnr;
+		}
+	}
+	glDeleteQueries(1, &query);
+	untrackTexture(tuneHalfOutput);
+	untrackTexture(tuneOutput);
+	glDeleteTextures(1, &tuneHalfOutput);
+	glDeleteTextures(1, &tuneOutput);
+	if (fastestTime < 0) {
+		std::cout << "No plan met the quality budget, using the most accurate" << std::endl;
+		return mostAccurate;
+	}
+	return fastest;
+}
+
+//Looks up the plan for the selected texture, tuning and persisting one if this resolution/sigma/device hasn't been seen before
+void applyAutoPlan() {
+	//an image that failed to load has nothing to tune on
+	if (textures[textureNum].m_handle == GLuint(-1)) {
+		autoPlanTexture = textureNum;
+		return;
+	}
+	std::string key = blurPlanKey(textures[textureNum].m_size.x, textures[textureNum].m_size.y, stageChannels(), tuneSigma, (const char*)glGetString(GL_RENDERER));
+	if (blurPlans.find(key) == blurPlans.end()) {
+		std::cout << std::endl << "Tuning blur for " << textures[textureNum].m_filepath << std::endl;
+		blurPlans[key] = tuneBlurPlan(tuneSigma);
+		frameEvents |= FRAME_TUNE;
+		saveBlurPlans();
+	}
+	setBlurPlan(blurPlans[key]);
+	autoPlanTexture = textureNum;
+}
+
+//Frame, CPU submission and swap/wait times (ms) of the current statistics window, and the frameEvents of each frame
+std::vector<double> frameTimes;
+std::vector<double> cpuTimes;
+std::vector<double> swapTimes;
+std::vector<unsigned int> frameEventLog;
+//Median frame time of the previous window (or the seed frames), 0 until there's one
+double medianFrameTime = 0;
+
+//Value below which the given fraction of times fall. Sorts the vector
+double percentile(std::vector<double>& times, double fraction) {
+	std::sort(times.begin(), times.end());
+	return times[std::min(times.size() - 1, size_t(fraction * times.size()))];
+}
+
+void printPercentiles(const char* name, std::vector<double>& times) {
+	std::cout << name << " p50 " << percentile(times, 0.5) << " p95 " << percentile(times, 0.95)
+		<< " p99 " << percentile(times, 0.99) << " max " << times.back() << std::endl;
+}
+
+//Reports a stall along with anything that happened during the frame that could explain it
+void reportStall(double frameTime, double cpuTime, double swapTime, unsigned int events) {
+	std::cout << std::endl << "Stall: " << frameTime << "ms (cpu " << cpuTime << "ms, swap " << swapTime << "ms)";
+	if (events & FRAME_REALLOCATION)
+		std::cout << " texture reallocation";
+	if (events & FRAME_SHADER_COMPILE)
+		std::cout << " shader compile";
+	if (events & FRAME_TUNE)
+		std::cout << " auto tuning";
+	if (events == 0)
+		std::cout << " unknown cause";
+	std::cout << std::endl;
+}
+
+//Records one frame's timings, reports stalls, and prints percentiles once the window is full. Frames before
+//there's a median keep their events, and are checked once the seed frames give one
+void recordFrame(double frameTime, double cpuTime, double swapTime) {
+	frameTimes.push_back(frameTime);
+	cpuTimes.push_back(cpuTime);
+	swapTimes.push_back(swapTime);
+	frameEventLog.push_back(frameEvents);
+	if (medianFrameTime > 0) {
+		if (frameTime > stallFactor * medianFrameTime) {
+			reportStall(frameTime, cpuTime, swapTime, frameEvents);
+		}
+	}
+	else if (frameTimes.size() >= size_t(stallSeedFrames)) {
+		//percentile sorts, and the seed frames are still needed in order
+		std::vector<double> seed = frameTimes;
+		medianFrameTime = percentile(seed, 0.5);
+		for (size_t i = 0; i < frameTimes.size(); i++) {
+			if (frameTimes[i] > stallFactor * medianFrameTime) {
+				reportStall(frameTimes[i], cpuTimes[i], swapTimes[i], frameEventLog[i]);
+			}
+		}
+	}
+	frameEvents = 0;
+
+	if (frameTimes.size() >= size_t(frameStatsWindow)) {
+		std::cout << std::endl << "Last " << frameTimes.size() << " frames (ms):" << std::endl;
+		printPercentiles("frame", frameTimes);
+		printPercentiles("cpu  ", cpuTimes);
+		printPercentiles("swap ", swapTimes);
+		medianFrameTime = percentile(frameTimes, 0.5);
+		frameTimes.clear();
+		cpuTimes.clear();
+		swapTimes.clear();
+		frameEventLog.clear();
+	}
+}
+
+double traceMicroseconds() {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - traceStart).count();
+}
+
+//Allocates the ring and its queries, and lines the GPU clock up with the CPU one. Needs a current context
+void initTrace() {
+	traceStart = std::chrono::steady_clock::now();
+	traceEvents.assign(traceCapacity, traceEvent());
+	std::vector<GLuint> queries(2 * traceCapacity);
+	glGenQueries(GLsizei(queries.size()), &queries[0]);
+	for (int i = 0; i < traceCapacity; i++) {
+		traceEvents[i].m_queries[0] = queries[2 * i];
+		traceEvents[i].m_queries[1] = queries[2 * i + 1];
+	}
+	glFinish();
+	GLint64 gpuTime;
+	glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	traceGPUOffset = gpuTime / 1000.0 - traceMicroseconds();
+	//GLX hands out a pointer for any name, so the entry points are only trusted when the driver reports them
+	GLint major;
+	GLint minor;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (glfwExtensionSupported("GL_KHR_debug") || major > 4 || (major == 4 && minor >= 3)) {
+		pushDebugGroup = (pushDebugGroupFunction)glfwGetProcAddress("glPushDebugGroup");
+		popDebugGroup = (popDebugGroupFunction)glfwGetProcAddress("glPopDebugGroup");
+	}
+}
+
+//Reads an event's GPU timestamps. Waits for them, which only happens when dumping as the ring is far behind the GPU
+void resolveTrace(traceEvent& event) {
+	if (event.m_resolved) {
+		return;
+	}
+	GLuint64 start;
+	GLuint64 end;
+	glGetQueryObjectui64v(event.m_queries[0], GL_QUERY_RESULT, &start);
+	glGetQueryObjectui64v(event.m_queries[1], GL_QUERY_RESULT, &end);
+	event.m_gpuStart = start / 1000.0 - traceGPUOffset;
+	event.m_gpuEnd = end / 1000.0 - traceGPUOffset;
+	event.m_resolved = true;
+}
+
+//Starts an event and returns its slot, or -1 before initTrace
+int beginTrace(const char* name) {
+	if (traceEvents.empty()) {
+		return -1;
+	}
+	int slot = int(traceCount++ % traceCapacity);
+	traceEvent& event = traceEvents[slot];
+	//the slot's previous event is thousands of events old, so this doesn't stall
+	resolveTrace(event);
+	if (pushDebugGroup) {
+		pushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+	}
+	event.m_name = name;
+	event.m_cpuStart = traceMicroseconds();
+	event.m_cpuEnd = -1;
+	event.m_resolved = false;
+	glQueryCounter(event.m_queries[0], GL_TIMESTAMP);
+	return slot;
+}
+
+void endTrace(int slot) {
+	if (slot < 0) {
+		return;
+	}
+	traceEvent& event = traceEvents[slot];
+	glQueryCounter(event.m_queries[1], GL_TIMESTAMP);
+	event.m_cpuEnd = traceMicroseconds();
+	if (popDebugGroup) {
+		popDebugGroup();
+	}
+}
+
+//Writes every finished event in the ring as Chrome trace JSON, oldest first
+bool dumpTrace(const std::string& path) {
+	std::ofstream file(path);
+	if (!file) {
+		std::cout << std::endl << "Failed to write " << path << std::endl;
+		return false;
+	}
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}}," << std::endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+	size_t first = traceCount > traceCapacity ? traceCount - traceCapacity : 0;
+	int written = 0;
+	for (size_t i = first; i < traceCount; i++) {
+		traceEvent& event = traceEvents[i % traceCapacity];
+		if (event.m_cpuEnd < 0) {
+			continue;
+		}
+		resolveTrace(event);
+		file << "," << std::endl << "{\"name\":\"" << event.m_name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << event.m_cpuStart
+			<< ",\"dur\":" << event.m_cpuEnd - event.m_cpuStart << "}";
+		file << "," << std::endl << "{\"name\":\"" << event.m_name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":" << event.m_gpuStart
+			<< ",\"dur\":" << event.m_gpuEnd - event.m_gpuStart << "}";
+		written++;
+	}
+	file << std::endl << "]}" << std::endl;
+	std::cout << std::endl << "Wrote " << written << " trace events to " << path << std::endl;
+	return true;
+}
+
+//Bytes a width x height texture uses, plus a third for a full mip chain. Drivers generally pad RGB to RGBA
+//so 3 channels are counted at 4 bytes per pixel
+size_t textureBytes(int width, int height, bool mipmaps, int channels) {
+	size_t bytes = size_t(width) * height * (channels == 1 || channels == 2 ? channels : 4);
+	return mipmaps ? bytes * 4 / 3 : bytes;
+}
+
+//Bytes of one blur intermediate at the current stage resolution and channels
+size_t stageTextureBytes() {
+	if (half) {
+		return textureBytes(sourceSize().x / 2, sourceSize().y / 2, false, stageChannels());
+	}
+	return textureBytes(sourceSize().x, sourceSize().y, false, stageChannels());
+}
+
+//Channels the stages store: blurChannels when set, otherwise the selected source's. Tiles and daemon frames are RGBA
+int stageChannels() {
+	if (externalInput) {
+		return 4;
+	}
+	int channels = blurChannels != 0 ? blurChannels : textures[textureNum].m_channels;
+	return channels > 0 ? channels : 4;
+}
+
+//Sized format for a texture of the given channels. RGB8 isn't required to be renderable, so 3 channels use RGBA8,
+//whose alpha stays 1 as RGB sources sample with an alpha of 1
+GLenum channelFormat(int channels) {
+	if (channels == 1) {
+		return GL_R8;
+	}
+	if (channels == 2) {
+		return GL_RG8;
+	}
+	return GL_RGBA8;
+}
+
+//Single channel textures are swizzled to sample as (r, r, r, 1), so they display as grey. Stages sampling them
+//still store r in their first channel, so masks can go through the same shaders as RGBA
+void setChannelSwizzle(GLuint texture, int channels) {
+	GLint swizzle[4] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+	if (channels == 1) {
+		swizzle[1] = GL_RED;
+		swizzle[2] = GL_RED;
+		swizzle[3] = GL_ONE;
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+}
+
+//When a mask is asked for from a source with alpha the mask is the alpha, so the source samples as (a, a, a, 1)
+void applySourceSwizzle(const textureData& text) {
+	if (text.m_handle == GLuint(-1)) {
+		return;
+	}
+	if (blurChannels == 1 && (text.m_channels == 2 || text.m_channels == 4)) {
+		GLint alpha = text.m_channels == 2 ? GL_GREEN : GL_ALPHA;
+		GLint swizzle[4] = { alpha, alpha, alpha, GL_ONE };
+		glBindTexture(GL_TEXTURE_2D, text.m_handle);
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+	else {
+		setChannelSwizzle(text.m_handle, text.m_channels);
+	}
+}
+
+//Blurring straight alpha bleeds the colour of transparent pixels into their neighbours, so sources whose last channel
+//is alpha are premultiplied in place once, after decoding and before they're cached. Opaque pixels are left alone
+void premultiplyAlpha(unsigned char* data, int width, int height, int channels) {
+	if (channels != 2 && channels != 4) {
+		return;
+	}
+	size_t pixels = size_t(width) * height;
+	for (size_t pixel = 0; pixel < pixels; pixel++) {
+		unsigned char* values = &data[pixel * channels];
+		int alpha = values[channels - 1];
+		if (alpha == 255) {
+			continue;
+		}
+		for (int c = 0; c < channels - 1; c++) {
+			values[c] = (unsigned char)((values[c] * alpha + 127) / 255);
+		}
+	}
+}
+
+//Texture bindDisplayTexture changed the swizzle of, and the swizzle to put back
+GLuint displaySwizzledTexture = 0;
+GLint displaySwizzle[4];
+
+//Binds a texture to draw to the window. Grey+alpha textures are stored as RG, which the stages need to keep so
+//alpha stays in the second channel, so for display alone they're swizzled to (r, r, r, g)
+void bindDisplayTexture(GLuint texture) {
+	glBindTexture(GL_TEXTURE_2D, texture);
+	GLint format;
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+	if (format != GL_RG8) {
+		return;
+	}
+	GLint swizzle[4];
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	//a source already showing its alpha as a mask is left as it is
+	if (swizzle[0] != GL_RED || swizzle[1] != GL_GREEN || swizzle[2] != GL_BLUE || swizzle[3] != GL_ALPHA) {
+		return;
+	}
+	GLint grey[4] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, grey);
+	memcpy(displaySwizzle, swizzle, sizeof(swizzle));
+	displaySwizzledTexture = texture;
+}
+
+//Puts back the swizzle bindDisplayTexture changed, once the frame has been drawn
+void restoreDisplayTexture() {
+	if (displaySwizzledTexture == 0) {
+		return;
+	}
+	glBindTexture(GL_TEXTURE_2D, displaySwizzledTexture);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, displaySwizzle);
+	displaySwizzledTexture = 0;
+}
+
+void trackTexture(GLuint texture, const std::string& name, size_t bytes) {
+	untrackTexture(texture);
+	trackedTextures[texture] = { name, bytes };
+	trackedBytes += bytes;
+}
+
+void untrackTexture(GLuint texture) {
+	auto found = trackedTextures.find(texture);
+	if (found != trackedTextures.end()) {
+		trackedBytes -= found->second.m_bytes;
+		trackedTextures.erase(found);
+	}
+}
+
+//Evicts least recently used sources, never the selected one, until bytes more fit in the budget.
+//Returns false if they still don't fit
+bool makeTextureRoom(size_t bytes) {
+	while (trackedBytes + bytes > textureBudget) {
+		textureData* oldest = nullptr;
+		for (size_t i = 0; i < textures.size(); i++) {
+			if (i != textureNum && textures[i].m_handle != GLuint(-1) && (!oldest || textures[i].m_lastUsed < oldest->m_lastUsed)) {
+				oldest = &textures[i];
+			}
+		}
+		if (!oldest) {
+			std::cout << std::endl << "Texture budget exceeded by " << (trackedBytes + bytes - textureBudget) / (1024.0 * 1024.0) << "MB" << std::endl;
+			return false;
+		}
+		std::cout << std::endl << "Evicting " << oldest->m_filepath << std::endl;
+		unloadTexture(*oldest);
+	}
+	return true;
+}
+
+void reportTextureMemory() {
+	std::cout << std::endl << "Texture memory: " << trackedBytes / (1024.0 * 1024.0) << "MB of " << textureBudget / (1024.0 * 1024.0) << "MB" << std::endl;
+	for (const auto& entry : trackedTextures) {
+		std::cout << "  " << entry.second.m_name << ": " << entry.second.m_bytes / (1024.0 * 1024.0) << "MB" << std::endl;
+	}
+}
+
+//Size of the image the stages are working on: the selected texture, or the tile/frame being processed
+glm::vec2 sourceSize() {
+	return externalInput ? externalInputSize : textures[textureNum].m_size;
+}
+
+//Source image for tiled mode. Binary PPMs are read straight from disk a tile at a time, anything else
+//stb_image can read has to be decoded whole first
+struct tiledSource
+{
+	FILE* m_file = nullptr;
+	long long m_dataOffset = 0;
+	int m_width = 0;
+	int m_height = 0;
+	int m_channels = 0;
+	unsigned char* m_decoded = nullptr;
+};
+
+//Reads the next number of a PPM header, skipping comments. Consumes the single whitespace after it
+bool readPPMValue(FILE* file, int& value) {
+	int c = fgetc(file);
+	while (c == '#' || isspace(c)) {
+		if (c == '#') {
+			while (c != '\n' && c != EOF) {
+				c = fgetc(file);
+			}
+		}
+		c = fgetc(file);
+	}
+	if (!isdigit(c)) {
+		return false;
+	}
+	value = 0;
+	while (isdigit(c)) {
+		value = value * 10 + c - '0';
+		c = fgetc(file);
+	}
+	return true;
+}
+
+bool openTiledSource(const std::string& path, tiledSource& source) {
+	source.m_file = fopen(path.c_str(), "rb");
+	if (source.m_file) {
+		int maxValue;
+		if (fgetc(source.m_file) == 'P' && fgetc(source.m_file) == '6' && readPPMValue(source.m_file, source.m_width)
+			&& readPPMValue(source.m_file, source.m_height) && readPPMValue(source.m_file, maxValue) && maxValue == 255) {
+			source.m_channels = 3;
+			source.m_dataOffset = ftell64(source.m_file);
+			return true;
+		}
+		fclose(source.m_file);
+		source.m_file = nullptr;
+	}
+	source.m_decoded = stbi_load(path.c_str(), &source.m_width, &source.m_height, &source.m_channels, 0);
+	return source.m_decoded != nullptr;
+}
+
+void closeTiledSource(tiledSource& source) {
+	if (source.m_file) {
+		fclose(source.m_file);
+	}
+	stbi_image_free(source.m_decoded);
+}
+
+//Reads a rectangle of the source as RGBA8. Grey images are expanded and missing alpha is set to 1.
+//Returns false if a PPM is shorter than its header says
+bool readTiledRegion(tiledSource& source, int x, int y, int width, int height, std::vector<unsigned char>& rgba) {
+	int channels = source.m_channels;
+	rgba.resize(size_t(width) * height * 4);
+	std::vector<unsigned char> row(size_t(width) * channels);
+	for (int j = 0; j < height; j++) {
+		const unsigned char* pixels;
+		if (source.m_file) {
+			fseek64(source.m_file, source.m_dataOffset + ((long long)(y + j) * source.m_width + x) * channels, SEEK_SET);
+			if (fread(&row[0], 1, row.size(), source.m_file) != row.size()) {
+				return false;
+			}
+			pixels = &row[0];
+		}
+		else {
+			pixels = source.m_decoded + (size_t(y + j) * source.m_width + x) * channels;
+		}
+		for (int i = 0; i < width; i++) {
+			const unsigned char* pixel = pixels + i * channels;
+			unsigned char* out = &rgba[(size_t(j) * width + i) * 4];
+			out[0] = pixel[0];
+			out[1] = channels >= 3 ? pixel[1] : pixel[0];
+			out[2] = channels >= 3 ? pixel[2] : pixel[0];
+			out[3] = channels == 4 ? pixel[3] : channels == 2 ? pixel[1] : 255;
+		}
+	}
+	return true;
+}
+
+//Creates a binary PPM of the full image size up front so tiles can be written into it in any order
+FILE* createTiledOutput(const std::string& path, int width, int height, long long& dataOffset) {
+	FILE* file = fopen(path.c_str(), "wb+");
+	if (!file) {
+		return nullptr;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	dataOffset = ftell64(file);
+	fseek64(file, dataOffset + (long long)width * height * 3 - 1, SEEK_SET);
+	fputc(0, file);
+	return file;
+}
+
+//Writes the width x height block at (regionX, regionY) of an RGBA8 region to (x, y) of the output.
+//Returns false if the disk is full or the write otherwise fails
+bool writeTiledRegion(FILE* file, long long dataOffset, int imageWidth, int x, int y, int width, int height,
+	const std::vector<unsigned char>& rgba, int regionWidth, int regionX, int regionY) {
+	std::vector<unsigned char> row(size_t(width) * 3);
+	for (int j = 0; j < height; j++) {
+		const unsigned char* pixels = &rgba[(size_t(regionY + j) * regionWidth + regionX) * 4];
+		for (int i = 0; i < width; i++) {
+			row[i * 3] = pixels[i * 4];
+			row[i * 3 + 1] = pixels[i * 4 + 1];
+			row[i * 3 + 2] = pixels[i * 4 + 2];
+		}
+		fseek64(file, dataOffset + ((long long)(y + j) * imageWidth + x) * 3, SEEK_SET);
+		if (fwrite(&row[0], 1, row.size(), file) != row.size()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//Distance in pixels a blur result can depend on. Each pass reaches the kernel radius, or for the fast
+//blur the texel past its furthest linear tap
+int blurApron() {
+	int radius = fastBlur ? int(ceil(fastBlurOffsets[1])) : std::max(blurKernel.m_centre, int(blurKernel.m_weights.size()) - 1 - blurKernel.m_centre);
+	return radius * blurIterations;
+}
+
+//Blurs an image of any size with the current blur stage into a binary PPM, a tile at a time. Each tile
+//is read with a halo of blurApron() pixels and the halo is clipped at the image edges, so the result is
+//the same as an untiled run. The half stage isn't supported as it would change the tile grid
+bool blurTiled(const std::string& inputPath, const std::string& outputPath) {
+	tiledSource source;
+	if (!openTiledSource(inputPath, source)) {
+		std::cout << "Failed to open " << inputPath << std::endl;
+		return false;
+	}
+	int apron = blurApron();
+	GLint maxTextureSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	int tile = std::min(tileSize, int(maxTextureSize) - 2 * apron);
+	long long dataOffset;
+	FILE* output = createTiledOutput(outputPath, source.m_width, source.m_height, dataOffset);
+	if (tile <= 0 || !output) {
+		std::cout << "Failed to create " << outputPath << std::endl;
+		closeTiledSource(source);
+		return false;
+	}
+
+	half = false;
+	externalInput = true;
+	externalInputSize = glm::vec2(0, 0);
+	GLuint tileInput;
+	glGenTextures(1, &tileInput);
+	glBindTexture(GL_TEXTURE_2D, tileInput);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	GLuint tileOutput = 0;
+	std::vector<unsigned char> pixels;
+	bool success = true;
+	for (int y = 0; y < source.m_height && success; y += tile) {
+		for (int x = 0; x < source.m_width && success; x += tile) {
+			int width = std::min(tile, source.m_width - x);
+			int height = std::min(tile, source.m_height - y);
+			int regionX = std::max(x - apron, 0);
+			int regionY = std::max(y - apron, 0);
+			int regionWidth = std::min(x + width + apron, source.m_width) - regionX;
+			int regionHeight = std::min(y + height + apron, source.m_height) - regionY;
+			//edge tiles are smaller so the intermediates need reallocating
+			if (externalInputSize != glm::vec2(regionWidth, regionHeight)) {
+				externalInputSize = glm::vec2(regionWidth, regionHeight);
+				blurDirty = true;
+				fastBlurDirty = true;
+				trackTexture(tileInput, "tile", textureBytes(regionWidth, regionHeight, false));
+			}
+
+			if (!readTiledRegion(source, regionX, regionY, regionWidth, regionHeight, pixels)) {
+				std::cout << std::endl << inputPath << " is truncated" << std::endl;
+				success = false;
+				break;
+			}
+			glBindTexture(GL_TEXTURE_2D, tileInput);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, regionWidth, regionHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+			if (fastBlur) {
+				fastBlurTexture(tileInput, tileOutput);
+			}
+			else {
+				simpleBlurTexture(tileInput, tileOutput);
+			}
+			if (tileOutput == 0) {
+				std::cout << std::endl << "A tile doesn't fit in the texture budget" << std::endl;
+				success = false;
+				break;
+			}
+			glBindTexture(GL_TEXTURE_2D, tileOutput);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+			if (!writeTiledRegion(output, dataOffset, source.m_width, x, y, width, height, pixels, regionWidth, x - regionX, y - regionY)) {
+				std::cout << std::endl << "Failed to write " << outputPath << std::endl;
+				success = false;
+				break;
+			}
+		}
+		std::cout << "\rTiled blur: " << std::min(y + tile, source.m_height) * 100 / source.m_height << "%";
+	}
+	std::cout << std::endl;
+
+	externalInput = false;
+	blurDirty = true;
+	halfDirty = true;
+	fastBlurDirty = true;
+	untrackTexture(tileInput);
+	untrackTexture(tileOutput);
+	glDeleteTextures(1, &tileInput);
+	glDeleteTextures(1, &tileOutput);
+	//buffered writes can still fail when the file is closed
+	if (fclose(output) != 0 && success) {
+		std::cout << "Failed to write " << outputPath << std::endl;
+		success = false;
+	}
+	closeTiledSource(source);
+	return success;
+}
+
+//Decoded images are cached in imageCacheDir so warm starts skip decoding. Each entry is an imageCacheHeader
+//followed by the pixels, which start at imageCacheAlignment so they can be uploaded straight from a mapping
+const char* imageCacheDir = "imageCache";
+const size_t imageCacheAlignment = 4096;
+bool useImageCache = true;
+
+struct imageCacheHeader
+{
+	char m_magic[4];
+	unsigned int m_version;
+	int m_width;
+	int m_height;
+	int m_channels;
+	//GL format of the pixel data
+	unsigned int m_format;
+	//modification time and size of the file the entry was decoded from
+	long long m_sourceTime;
+	unsigned long long m_sourceSize;
+	unsigned long long m_dataOffset;
+};
+const char imageCacheMagic[4] = { 'B', 'W', 'I', 'C' };
+//2: sources with alpha are stored premultiplied
+const unsigned int imageCacheVersion = 2;
+
+//Entries are named after a hash of the source path
+std::string imageCachePath(const std::string& path) {
+	std::stringstream name;
+	name << imageCacheDir << "/" << std::hex << std::hash<std::string>()(path) << ".raw";
+	return name.str();
+}
+
+bool sourceStamp(const std::string& path, long long& time, unsigned long long& size) {
+	std::error_code error;
+	auto writeTime = std::filesystem::last_write_time(path, error);
+	if (error) {
+		return false;
+	}
+	time = writeTime.time_since_epoch().count();
+	size = std::filesystem::file_size(path, error);
+	return !error;
+}
+
+//Maps the entry for a source and returns its pixels, or null if there isn't an up to date entry
+const unsigned char* readImageCache(const std::string& path, mappedFile& mapping, int& width, int& height, int& channels) {
+	long long time;
+	unsigned long long size;
+	if (!useImageCache || !sourceStamp(path, time, size) || !mapping.open(imageCachePath(path))) {
+		return nullptr;
+	}
+	imageCacheHeader header;
+	if (mapping.size() < sizeof(header)) {
+		mapping.close();
+		return nullptr;
+	}
+	memcpy(&header, mapping.data(), sizeof(header));
+	if (memcmp(header.m_magic, imageCacheMagic, sizeof(imageCacheMagic)) != 0 || header.m_version != imageCacheVersion
+		|| header.m_sourceTime != time || header.m_sourceSize != size
+		|| header.m_dataOffset + size_t(header.m_width) * header.m_height * header.m_channels > mapping.size()) {
+		mapping.close();
+		return nullptr;
+	}
+	width = header.m_width;
+	height = header.m_height;
+	channels = header.m_channels;
+	return mapping.data() + header.m_dataOffset;
+}
+
+void writeImageCache(const std::string& path, const unsigned char* data, int width, int height, int channels) {
+	long long time;
+	unsigned long long size;
+	if (!useImageCache || !sourceStamp(path, time, size)) {
+		return;
+	}
+	std::error_code error;
+	std::filesystem::create_directories(imageCacheDir, error);
+
+	imageCacheHeader header = {};
+	memcpy(header.m_magic, imageCacheMagic, sizeof(imageCacheMagic));
+	header.m_version = imageCacheVersion;
+	header.m_width = width;
+	header.m_height = height;
+	header.m_channels = channels;
+	header.m_format = channels == 1 ? GL_RED : channels == 2 ? GL_RG : channels == 3 ? GL_RGB : GL_RGBA;
+	header.m_sourceTime = time;
+	header.m_sourceSize = size;
+	header.m_dataOffset = imageCacheAlignment;
+
+	//written to a temporary file and renamed so a partially written entry is never mapped
+	std::string cachePath = imageCachePath(path);
+	std::ofstream file(cachePath + ".tmp", std::ios::binary);
+	std::vector<char> padding(header.m_dataOffset - sizeof(header), 0);
+	file.write((const char*)&header, sizeof(header));
+	file.write(&padding[0], padding.size());
+	file.write((const char*)data, size_t(width) * height * channels);
+	file.close();
+	if (file) {
+		std::filesystem::rename(cachePath + ".tmp", cachePath, error);
+	}
+}
+
+//Runs work over [0, count) split into one contiguous range per hardware thread
+void parallelFor(int count, const std::function<void(int, int)>& work) {
+	int threadCount = std::max(1, int(std::thread::hardware_concurrency()));
+	int chunk = (count + threadCount - 1) / threadCount;
+	std::vector<std::thread> threads;
+	for (int first = 0; first < count; first += chunk) {
+		threads.emplace_back(work, first, std::min(count, first + chunk));
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+int nextPowerOfTwo(int value) {
+	int power = 1;
+	while (power < value) {
+		power <<= 1;
+	}
+	return power;
+}
+
+//Twiddles and bit reversal permutation for a power of two FFT size, cached per size. The twiddles are split
+//into real and imaginary arrays with each stage stored contiguously: the stage with halfLength h holds
+//exp(-pi i k / h) for k < h from index h - 1, so the butterfly loop reads them with unit stride
+struct fftTables
+{
+	std::vector<float> m_twiddleReal;
+	std::vector<float> m_twiddleImag;
+	std::vector<int> m_reversed;
+};
+std::map<int, fftTables> fftTableCache;
+//Spectrum of the gaussian kernel, cached per (FFT size, sigma). The kernel is even so its spectrum is real,
+//and 1 / size is folded in so the inverse transform doesn't need scaling
+std::map<std::pair<int, float>, std::vector<float>> kernelSpectrumCache;
+//Radius above which the FFT path beats direct convolution, measured per resolution and FFT size
+std::map<std::tuple<int, int, int, int>, int> fftCrossoverRadius;
+//Largest radius the crossover probe convolves directly, and the most texel fetches one probe pass may do, so
+//a huge image can't make a single draw run long enough for the driver to reset the GPU
+const int fftProbeMaxRadius = 256;
+const double fftProbeMaxFetches = 2147483648.0;
+
+const fftTables& fftTablesForSize(int size) {
+	fftTables& tables = fftTableCache[size];
+	if (tables.m_reversed.empty()) {
+		for (int halfLength = 1; halfLength < size; halfLength <<= 1) {
+			for (int k = 0; k < halfLength; k++) {
+				double angle = -glm::pi<double>() * k / halfLength;
+				tables.m_twiddleReal.push_back(float(cos(angle)));
+				tables.m_twiddleImag.push_back(float(sin(angle)));
+			}
+		}
+		tables.m_reversed.resize(size);
+		for (int i = 1, j = 0; i < size; i++) {
+			int bit = size >> 1;
+			for (; j & bit; bit >>= 1) {
+				j ^= bit;
+			}
+			j ^= bit;
+			tables.m_reversed[i] = j;
+		}
+	}
+	return tables;
+}
+
+//One stage's butterflies over a block. Every array is separate and read with unit stride, so the compiler
+//vectorizes the loop (SSE/AVX/NEON, whatever the build targets) without any intrinsics
+void fftButterflies(float* __restrict evenReal, float* __restrict evenImag, float* __restrict oddReal, float* __restrict oddImag,
+	const float* __restrict twiddleReal, const float* __restrict twiddleImag, float sign, int count) {
+	for (int k = 0; k < count; k++) {
+		float imag = sign * twiddleImag[k];
+		float productReal = oddReal[k] * twiddleReal[k] - oddImag[k] * imag;
+		float productImag = oddReal[k] * imag + oddImag[k] * twiddleReal[k];
+		oddReal[k] = evenReal[k] - productReal;
+		oddImag[k] = evenImag[k] - productImag;
+		evenReal[k] += productReal;
+		evenImag[k] += productImag;
+	}
+}
+
+//In place iterative radix 2 FFT on split real and imaginary arrays. The inverse isn't scaled
+void fft(float* real, float* imag, int size, const fftTables& tables, bool inverse) {
+	for (int i = 1; i < size; i++) {
+		int j = tables.m_reversed[i];
+		if (i < j) {
+			std::swap(real[i], real[j]);
+			std::swap(imag[i], imag[j]);
+		}
+	}
+	//the inverse uses the conjugate twiddles
+	float sign = inverse ? -1.0f : 1.0f;
+	for (int halfLength = 1; halfLength < size; halfLength <<= 1) {
+		const float* twiddleReal = &tables.m_twiddleReal[halfLength - 1];
+		const float* twiddleImag = &tables.m_twiddleImag[halfLength - 1];
+		for (int i = 0; i < size; i += 2 * halfLength) {
+			fftButterflies(real + i, imag + i, real + i + halfLength, imag + i + halfLength, twiddleReal, twiddleImag, sign, halfLength);
+		}
+	}
+}
+
+int wideBlurRadius(float sigma) {
+	return int(ceil(3 * sigma));
+}
+
+const std::vector<float>& kernelSpectrum(int size, float sigma) {
+	std::vector<float>& spectrum = kernelSpectrumCache[std::make_pair(size, sigma)];
+	if (spectrum.empty()) {
+		separableKernel kernel = gaussianKernel(sigma, wideBlurRadius(sigma));
+		std::vector<float> real(size);
+		std::vector<float> imag(size);
+		//centred on element 0, wrapping negative offsets around to the end
+		for (int i = 0; i < int(kernel.m_weights.size()); i++) {
+			real[(i - kernel.m_centre + size) % size] += kernel.m_weights[i];
+		}
+		fft(&real[0], &imag[0], size, fftTablesForSize(size), false);
+		for (float value : real) {
+			spectrum.push_back(value / size);
+		}
+	}
+	return spectrum;
+}
+
+//Convolves lines [first, last) of an RGBA float image with a kernel spectrum. Pixel i of line l is at
+//l * lineStride + i * pixelStride, so the same code does rows and columns. Lines are padded by the radius
+//with clamped edge values, so the circular convolution matches clamp to edge addressing. As the spectrum
+//is real, two channels share each complex transform: R/G in one and B/A in the other
+void fftConvolveLines(float* pixels, int first, int last, int length, size_t lineStride, size_t pixelStride, int radius,
+	int size, const fftTables& tables, const std::vector<float>& spectrum) {
+	std::vector<float> red(size);
+	std::vector<float> green(size);
+	std::vector<float> blue(size);
+	std::vector<float> alpha(size);
+	for (int line = first; line < last; line++) {
+		float* start = pixels + line * lineStride * 4;
+		for (int j = 0; j < size; j++) {
+			const float* pixel = start + std::min(std::max(j - radius, 0), length - 1) * pixelStride * 4;
+			red[j] = pixel[0];
+			green[j] = pixel[1];
+			blue[j] = pixel[2];
+			alpha[j] = pixel[3];
+		}
+		fft(&red[0], &green[0], size, tables, false);
+		fft(&blue[0], &alpha[0], size, tables, false);
+		for (int j = 0; j < size; j++) {
+			red[j] *= spectrum[j];
+			green[j] *= spectrum[j];
+			blue[j] *= spectrum[j];
+			alpha[j] *= spectrum[j];
+		}
+		fft(&red[0], &green[0], size, tables, true);
+		fft(&blue[0], &alpha[0], size, tables, true);
+		for (int i = 0; i < length; i++) {
+			float* pixel = start + i * pixelStride * 4;
+			pixel[0] = red[i + radius];
+			pixel[1] = green[i + radius];
+			pixel[2] = blue[i + radius];
+			pixel[3] = alpha[i + radius];
+		}
+	}
+}
+
+//Gaussian blur of RGBA float pixels through the FFT: rows then columns, spread over every hardware thread
+void fftGaussianBlur(std::vector<float>& pixels, int width, int height, float sigma) {
+	int radius = wideBlurRadius(sigma);
+	float* data = &pixels[0];
+
+	int size = nextPowerOfTwo(width + 2 * radius);
+	const fftTables* tables = &fftTablesForSize(size);
+	const std::vector<float>* spectrum = &kernelSpectrum(size, sigma);
+	parallelFor(height, [&](int first, int last) {
+		fftConvolveLines(data, first, last, width, width, 1, radius, size, *tables, *spectrum);
+	});
+
+	size = nextPowerOfTwo(height + 2 * radius);
+	tables = &fftTablesForSize(size);
+	spectrum = &kernelSpectrum(size, sigma);
+	parallelFor(width, [&](int first, int last) {
+		fftConvolveLines(data, first, last, height, 1, width, radius, size, *tables, *spectrum);
+	});
+}
+
+//Times the FFT path at sigma (its cost depends on the padded size, barely on the radius) against single pass
+//direct convolution at doubling radii and returns the first radius where the FFT wins. Both are wall clock
+//times to a glFinish, as the FFT path includes its readback and upload. Direct convolution costs about the
+//same per tap at any radius, so when the probe caps are reached first the crossover is extrapolated from
+//the last radius timed
+int measureFFTCrossover(GLuint input, GLuint output, int width, int height, float sigma) {
+	glFinish();
+	auto start = std::chrono::steady_clock::now();
+	std::vector<float> pixels = readTexture(input, width, height);
+	fftGaussianBlur(pixels, width, height, sigma);
+	glBindTexture(GL_TEXTURE_2D, output);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, &pixels[0]);
+	glFinish();
+	double fftTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	int crossover = INT_MAX;
+	int lastRadius = 0;
+	double lastTime = 0;
+	for (int radius = 4; radius <= fftProbeMaxRadius && crossover == INT_MAX; radius *= 2) {
+		//the smallest radius always runs, it's no more than a normal blur would do
+		if (lastRadius > 0 && double(width) * height * (2 * radius + 1) > fftProbeMaxFetches) {
+			break;
+		}
+		start = std::chrono::steady_clock::now();
+		separableConvolve(input, output, gaussianKernel(radius / 3.0f, radius), 1);
+		glFinish();
+		lastTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		lastRadius = radius;
+		if (lastTime > fftTime) {
+			crossover = radius;
+		}
+	}
+	if (crossover == INT_MAX && lastTime > 0) {
+		crossover = int(std::min(lastRadius * fftTime / lastTime, double(INT_MAX)));
+	}
+	std::cout << std::endl << "FFT blur at " << width << "x" << height << ": " << fftTime << "ms, used from radius " << crossover << std::endl;
+	return crossover;
+}
+
+//Single gaussian of wideBlurSigma source pixels. Uses direct convolution below the crossover radius for
+//this resolution and the CPU FFT path above it
+void wideBlurTexture(GLuint input, GLuint output) {
+	traceScope trace("wideBlurTexture");
+	int width = half ? int(sourceSize().x / 2) : int(sourceSize().x);
+	int height = half ? int(sourceSize().y / 2) : int(sourceSize().y);
+	float sigma = half ? wideBlurSigma / 2 : wideBlurSigma;
+	int radius = wideBlurRadius(sigma);
+	//the FFT cost steps with the padded sizes, so each pair of them gets its own measurement
+	std::tuple<int, int, int, int> key = std::make_tuple(width, height, nextPowerOfTwo(width + 2 * radius), nextPowerOfTwo(height + 2 * radius));
+	if (fftCrossoverRadius.find(key) == fftCrossoverRadius.end()) {
+		fftCrossoverRadius[key] = measureFFTCrossover(input, output, width, height, sigma);
+	}
+	if (radius < fftCrossoverRadius[key]) {
+		separableConvolve(input, output, gaussianKernel(sigma, radius), 1);
+		return;
+	}
+	std::vector<float> pixels = readTexture(input, width, height);
+	fftGaussianBlur(pixels, width, height, sigma);
+	glBindTexture(GL_TEXTURE_2D, output);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, &pixels[0]);
+}
+
+//Temporal mode state: a copy of the previous blur input, the per block difference map, the texture the blur
+//stage renders into, and the composited result that was handed out as the stage output
+GLuint temporalPrevious = 0;
+GLuint temporalBlocks = 0;
+GLuint temporalChain = 0;
+GLuint temporalOutput = 0;
+glm::vec2 temporalSize = glm::vec2(0, 0);
+int temporalChannels = 0;
+int temporalFrame = 0;
+//The stage, kernel type and size, iterations and tap merging the last full frame was blurred with. Bands
+//blurred with anything else wouldn't match the rest of the output, so a change forces a full frame
+std::tuple<void (*)(GLuint, GLuint&), int, int, int, bool> temporalBlurred;
+//The block map is read back through a pixel buffer a frame late so the diff never stalls the pipeline.
+//temporalPending is the copy of the input it was measured on, which the changed bands are re-blurred from
+GLuint temporalPending = 0;
+GLuint temporalReadback = 0;
+bool temporalReadbackPending = false;
+
+//Flat tile state: the per tile minimum and maximum maps and their readbacks, what they were measured from, the
+//texture the blur stage renders into, and the composited result handed out as the stage output
+GLuint flatLowMap = 0;
+GLuint flatHighMap = 0;
+std::vector<unsigned char> flatLow;
+std::vector<unsigned char> flatHigh;
+std::tuple<GLuint, unsigned int, int, int, int> flatMeasured;
+GLuint flatChain = 0;
+GLuint flatOutput = 0;
+glm::vec2 flatSize = glm::vec2(0, 0);
+int flatChannels = 0;
+
+//Rectangle in texels
+struct blockRect
+{
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+//Grows a rectangle by amount on every side, clipped to the image
+blockRect dilateRect(const blockRect& rect, int amount, int width, int height) {
+	blockRect result;
+	result.x = std::max(rect.x - amount, 0);
+	result.y = std::max(rect.y - amount, 0);
+	result.width = std::min(rect.x + rect.width + amount, width) - result.x;
+	result.height = std::min(rect.y + rect.height + amount, height) - result.y;
+	return result;
+}
+
+void allocateTemporalTexture(GLuint& texture, const char* name, GLenum format, int width, int height) {
+	if (texture != 0) {
+		untrackTexture(texture);
+		glDeleteTextures(1, &texture);
+	}
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	int channels = format == GL_R8 ? 1 : format == GL_RG8 ? 2 : 4;
+	setChannelSwizzle(texture, channels);
+	trackTexture(texture, name, textureBytes(width, height, false, channels));
+}
+
+//Frees a texture and stops tracking it, leaving it 0 so it's reallocated when next used
+void freeTemporalTexture(GLuint& texture) {
+	if (texture != 0) {
+		untrackTexture(texture);
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
+}
+
+//Frees temporal mode's own textures and readback buffer once it's turned off, so they don't count against
+//textureBudget. The output is left as it's the stage output whether or not temporal mode is on
+void releaseTemporalState() {
+	freeTemporalTexture(temporalPrevious);
+	freeTemporalTexture(temporalPending);
+	freeTemporalTexture(temporalBlocks);
+	freeTemporalTexture(temporalChain);
+	if (temporalReadback != 0) {
+		glDeleteBuffers(1, &temporalReadback);
+		temporalReadback = 0;
+	}
+	temporalReadbackPending = false;
+	temporalSize = glm::vec2(0, 0);
+}
+
+//Frees the flat tile maps and chain once tiles aren't being skipped. The output is left as with temporal mode
+void releaseFlatState() {
+	freeTemporalTexture(flatLowMap);
+	freeTemporalTexture(flatHighMap);
+	freeTemporalTexture(flatChain);
+	flatLow.clear();
+	flatHigh.clear();
+	flatSize = glm::vec2(0, 0);
+	flatMeasured = std::make_tuple(GLuint(0), 0u, 0, 0, 0);
+}
+
+//Renders input into target with the copy shader, limited to the scissor rectangle if one is enabled
+void copyTexture(GLuint input, GLuint target, int width, int height) {
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+	glViewport(0, 0, width, height);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, input);
+	copyShader.use();
+	renderQuad();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//Frees the multi-radius textures and, in multi-radius mode, allocates one per radius at the stage resolution
+void allocateMultiRadiusOutputs() {
+	for (GLuint& level : multiRadiusOutputs) {
+		untrackTexture(level);
+		glDeleteTextures(1, &level);
+	}
+	multiRadiusOutputs.clear();
+	if (!multiRadius) {
+		return;
+	}
+	if (!makeTextureRoom(multiRadiusSigmas.size() * stageTextureBytes())) {
+		return;
+	}
+	int width = half ? int(sourceSize().x / 2) : int(sourceSize().x);
+	int height = half ? int(sourceSize().y / 2) : int(sourceSize().y);
+	multiRadiusOutputs.resize(multiRadiusSigmas.size());
+	for (GLuint& level : multiRadiusOutputs) {
+		glGenTextures(1, &level);
+		glBindTexture(GL_TEXTURE_2D, level);
+		glTexImage2D(GL_TEXTURE_2D, 0, channelFormat(stageChannels()), width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		setChannelSwizzle(level, stageChannels());
+		trackTexture(level, "multiRadiusOutput", stageTextureBytes());
+	}
+}
+
+//Blurs input at every multiRadiusSigmas radius in one libblurwork call and averages the results into output
+//with additive blending. Its chained gaussians reach much further than blurApron(), so temporal mode always
+//runs it over the whole frame
+void multiRadiusTexture(GLuint input, GLuint output) {
+	traceScope trace("multiRadiusTexture");
+	int width = half ? int(sourceSize().x / 2) : int(sourceSize().x);
+	int height = half ? int(sourceSize().y / 2) : int(sourceSize().y);
+	std::vector<float> sigmas = multiRadiusSigmas;
+	for (float& sigma : sigmas) {
+		sigma = half ? sigma / 2 : sigma;
+	}
+	blurWorkSetMergeTaps(blurLibrary, mergeTaps);
+	blurWorkSetWorkingTexture(blurLibrary, blurWorkingTexture);
+	blurWorkBlurGaussians(blurLibrary, input, &multiRadiusOutputs[0], &sigmas[0], int(sigmas.size()));
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output, 0);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	float share = 1.0f / multiRadiusOutputs.size();
+	glEnable(GL_BLEND);
+	glBlendColor(share, share, share, share);
+	glBlendFunc(GL_CONSTANT_COLOR, GL_ONE);
+	for (GLuint level : multiRadiusOutputs) {
+		copyTexture(level, output, width, height);
+	}
+	glDisable(GL_BLEND);
+}
+
+//Merges the marked blocks of a blocksX x blocksY grid into bands. Consecutive rows of blocks with marks become
+//one band spanning all their marked blocks
+std::vector<blockRect> blockBands(const std::vector<bool>& marked, int blocksX, int blocksY, int blockSize, int width, int height) {
+	std::vector<blockRect> bands;
+	bool inBand = false;
+	for (int y = 0; y < blocksY; y++) {
+		int first = blocksX;
+		int last = -1;
+		for (int x = 0; x < blocksX; x++) {
+			if (marked[y * blocksX + x]) {
+				first = std::min(first, x);
+				last = x;
+			}
+		}
+		if (last < 0) {
+			inBand = false;
+			continue;
+		}
+		blockRect rect = { first * blockSize, y * blockSize, (last + 1 - first) * blockSize, blockSize };
+		if (inBand) {
+			blockRect& band = bands.back();
+			int right = std::max(band.x + band.width, rect.x + rect.width);
+			band.x = std::min(band.x, rect.x);
+			band.width = right - band.x;
+			band.height += blockSize;
+		}
+		else {
+			bands.push_back(rect);
+		}
+		inBand = true;
+	}
+	//the last row and column of blocks can hang over the image
+	for (blockRect& band : bands) {
+		band = dilateRect(band, 0, width, height);
+	}
+	return bands;
+}
+
+//Copies input to temporalPending and compares it against the previous frame one block at a time on the GPU.
+//The block map is read into temporalReadback without waiting, for finishBlockDiff to pick up next frame
+void startBlockDiff(GLuint input, int width, int height) {
+	traceScope trace("startBlockDiff");
+	int blocksX = (width + temporalBlockSize - 1) / temporalBlockSize;
+	int blocksY = (height + temporalBlockSize - 1) / temporalBlockSize;
+	copyTexture(input, temporalPending, width, height);
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, temporalBlocks, 0);
+	glViewport(0, 0, blocksX, blocksY);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, temporalPrevious);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, temporalPending);
+	blockDiffShader.use();
+	blockDiffShader.setInt("current", 0);
+	blockDiffShader.setInt("previous", 1);
+	blockDiffShader.setInt("blockSize", temporalBlockSize);
+	renderQuad();
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, temporalReadback);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, blocksX, blocksY, GL_RED, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	temporalReadbackPending = true;
+}
+
+//Maps the block map startBlockDiff read back last frame and returns bands of changed blocks. Consecutive rows
+//of blocks with changes are merged into one band spanning all their changes
+std::vector<blockRect> finishBlockDiff(int width, int height, float& changedFraction) {
+	traceScope trace("finishBlockDiff");
+	int blocksX = (width + temporalBlockSize - 1) / temporalBlockSize;
+	int blocksY = (height + temporalBlockSize - 1) / temporalBlockSize;
+	std::vector<bool> changed(size_t(blocksX) * blocksY);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, temporalReadback);
+	const unsigned char* differences = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, changed.size(), GL_MAP_READ_BIT);
+	//a lost mapping is treated as everything changed
+	for (size_t i = 0; i < changed.size(); i++) {
+		changed[i] = !differences || differences[i] > temporalThreshold;
+	}
+	if (differences) {
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	temporalReadbackPending = false;
+	changedFraction = float(std::count(changed.begin(), changed.end(), true)) / (blocksX * blocksY);
+	return blockBands(changed, blocksX, blocksY, temporalBlockSize, width, height);
+}
+
+//Reads back the minimum and maximum of each channel within each flatTileSize tile of input, rendering both
+//maps in one pass through two colour attachments
+void measureFlatTiles(GLuint input, int blocksX, int blocksY) {
+	traceScope trace("measureFlatTiles");
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, flatLowMap, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, flatHighMap, 0);
+	GLenum attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, attachments);
+	glViewport(0, 0, blocksX, blocksY);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, input);
+	tileRangeShader.use();
+	tileRangeShader.setInt("image", 0);
+	tileRangeShader.setInt("blockSize", flatTileSize);
+	renderQuad();
+
+	flatLow.resize(size_t(blocksX) * blocksY * 4);
+	flatHigh.resize(flatLow.size());
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, blocksX, blocksY, GL_RGBA, GL_UNSIGNED_BYTE, &flatLow[0]);
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	glReadPixels(0, 0, blocksX, blocksY, GL_RGBA, GL_UNSIGNED_BYTE, &flatHigh[0]);
+	//everything else uses fb with the one attachment
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glDrawBuffers(1, attachments);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//Marks the tiles whose neighbourhood of reach tiles on every side isn't flat. The neighbourhood minimum and
+//maximum are found separably, a row pass then a column pass
+std::vector<bool> unflatTiles(int blocksX, int blocksY, int reach) {
+	std::vector<unsigned char> rowLow(flatLow.size());
+	std::vector<unsigned char> rowHigh(flatHigh.size());
+	for (int y = 0; y < blocksY; y++) {
+		for (int x = 0; x < blocksX; x++) {
+			for (int c = 0; c < 4; c++) {
+				unsigned char low = 255;
+				unsigned char high = 0;
+				for (int i = std::max(x - reach, 0); i <= std::min(x + reach, blocksX - 1); i++) {
+					low = std::min(low, flatLow[(y * blocksX + i) * 4 + c]);
+					high = std::max(high, flatHigh[(y * blocksX + i) * 4 + c]);
+				}
+				rowLow[(y * blocksX + x) * 4 + c] = low;
+				rowHigh[(y * blocksX + x) * 4 + c] = high;
+			}
+		}
+	}
+	std::vector<bool> unflat(size_t(blocksX) * blocksY);
+	for (int y = 0; y < blocksY; y++) {
+		for (int x = 0; x < blocksX; x++) {
+			for (int c = 0; c < 4; c++) {
+				unsigned char low = 255;
+				unsigned char high = 0;
+				for (int j = std::max(y - reach, 0); j <= std::min(y + reach, blocksY - 1); j++) {
+					low = std::min(low, rowLow[(j * blocksX + x) * 4 + c]);
+					high = std::max(high, rowHigh[(j * blocksX + x) * 4 + c]);
+				}
+				if (high - low > flatThreshold) {
+					unflat[y * blocksX + x] = true;
+				}
+			}
+		}
+	}
+	return unflat;
+}
+
+//Runs a blur stage only over the tiles without a flat neighbourhood. The input is copied into the result, then
+//each band of remaining tiles is blurred with the scissor set to the band plus an apron, which leaves the band
+//itself correct, and the band is copied over. The tile maps are kept until the input or its contents change
+void flatStage(void (*stage)(GLuint, GLuint&), GLuint input, GLuint& output) {
+	int width = half ? int(sourceSize().x / 2) : int(sourceSize().x);
+	int height = half ? int(sourceSize().y / 2) : int(sourceSize().y);
+	int blocksX = (width + flatTileSize - 1) / flatTileSize;
+	int blocksY = (height + flatTileSize - 1) / flatTileSize;
+	//C changes the channels, which the output's format and swizzle have to follow
+	if (flatSize != glm::vec2(width, height) || output != flatOutput || flatChannels != stageChannels()) {
+		allocateTemporalTexture(flatLowMap, "flatLowMap", GL_RGBA8, blocksX, blocksY);
+		allocateTemporalTexture(flatHighMap, "flatHighMap", GL_RGBA8, blocksX, blocksY);
+		allocateTemporalTexture(output, "flatOutput", channelFormat(stageChannels()), width, height);
+		flatOutput = output;
+		flatSize = glm::vec2(width, height);
+		flatChannels = stageChannels();
+		flatMeasured = std::make_tuple(GLuint(0), 0u, 0, 0, 0);
+	}
+	//the source's contents change with the selection, and its channels with the swizzle blurChannels picks
+	std::tuple<GLuint, unsigned int, int, int, int> measured = std::make_tuple(input, textureNum, blurChannels, width, height);
+	if (measured != flatMeasured) {
+		measureFlatTiles(input, blocksX, blocksY);
+		flatMeasured = measured;
+	}
+
+	int apron = blurApron();
+	std::vector<bool> blurred = unflatTiles(blocksX, blocksY, (apron + flatTileSize - 1) / flatTileSize);
+
+	copyTexture(input, output, width, height);
+	for (const blockRect& band : blockBands(blurred, blocksX, blocksY, flatTileSize, width, height)) {
+		blockRect scissor = dilateRect(band, apron, width, height);
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(scissor.x, scissor.y, scissor.width, scissor.height);
+		stage(input, flatChain);
+		glScissor(band.x, band.y, band.width, band.height);
+		copyTexture(flatChain, output, width, height);
+		glDisable(GL_SCISSOR_TEST);
+	}
+}
+
+//Re-blurs one band of input and copies it into output
+void blurTemporalBand(void (*stage)(GLuint, GLuint&), GLuint input, GLuint output, const blockRect& band, int width, int height) {
+	int apron = blurApron();
+	blockRect scissor = dilateRect(band, 2 * apron, width, height);
+	blockRect copy = dilateRect(band, apron, width, height);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(scissor.x, scissor.y, scissor.width, scissor.height);
+	stage(input, temporalChain);
+	glScissor(copy.x, copy.y, copy.width, copy.height);
+	copyTexture(temporalChain, output, width, height);
+	glDisable(GL_SCISSOR_TEST);
+}
+
+//Runs a blur stage, through temporal reuse when it's enabled. Output only changes within the blur's apron
+//of a changed block, and computing that correctly needs the stage's inputs within twice the apron, so each
+//band is re-blurred with the scissor set to the band plus 2 aprons and then the band plus 1 apron is copied
+//into the result. The changes are only known a frame after they're measured, so the bands are re-blurred
+//from the input they were measured on and a changed region shows one frame late. Full frames blur the
+//current input
+void blurStage(void (*stage)(GLuint, GLuint&), GLuint input, GLuint& output) {
+	//the wide and multi-radius blurs reach further than blurApron()
+	if (!temporal && flatSkip && !wideBlur && !multiRadius) {
+		flatStage(stage, input, output);
+		return;
+	}
+	//temporal mode and the wide and multi-radius blurs bypass the tile maps while they're on
+	releaseFlatState();
+	if (!temporal) {
+		stage(input, output);
+		return;
+	}
+	int width = half ? int(sourceSize().x / 2) : int(sourceSize().x);
+	int height = half ? int(sourceSize().y / 2) : int(sourceSize().y);
+	//a reallocated stage has nothing to reuse, the FFT path ignores the scissor, and the wide and multi-radius
+	//blurs reach further than the blurApron() margin the bands are given
+	std::tuple<void (*)(GLuint, GLuint&), int, int, int, bool> blurred = std::make_tuple(stage, kernelType, kernelSize, blurIterations, mergeTaps);
+	bool full = (stage == simpleBlurTexture ? blurDirty : fastBlurDirty) || wideBlur || multiRadius || blurred != temporalBlurred
+		|| temporalFrame % temporalRefreshInterval == 0;
+	if (temporalSize != glm::vec2(width, height) || output != temporalOutput || temporalChannels != stageChannels()) {
+		int blocksX = (width + temporalBlockSize - 1) / temporalBlockSize;
+		int blocksY = (height + temporalBlockSize - 1) / temporalBlockSize;
+		allocateTemporalTexture(temporalPrevious, "temporalPrevious", GL_RGBA8, width, height);
+		allocateTemporalTexture(temporalPending, "temporalPending", GL_RGBA8, width, height);
+		allocateTemporalTexture(temporalBlocks, "temporalBlocks", GL_R8, blocksX, blocksY);
+		if (temporalReadback == 0) {
+			glGenBuffers(1, &temporalReadback);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, temporalReadback);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size_t(blocksX) * blocksY, NULL, GL_STREAM_READ);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		allocateTemporalTexture(output, "temporalOutput", channelFormat(stageChannels()), width, height);
+		temporalOutput = output;
+		temporalSize = glm::vec2(width, height);
+		temporalChannels = stageChannels();
+		full = true;
+	}
+	temporalFrame++;
+
+	std::vector<blockRect> bands;
+	float changedFraction = 0;
+	if (!full && temporalReadbackPending) {
+		bands = finishBlockDiff(width, height, changedFraction);
+	}
+	if (full || changedFraction > temporalFullFraction) {
+		//anything still in flight was measured against a previous frame that's being replaced
+		temporalReadbackPending = false;
+		blurTemporalBand(stage, input, output, { 0, 0, width, height }, width, height);
+		copyTexture(input, temporalPrevious, width, height);
+		temporalBlurred = blurred;
+		return;
+	}
+	for (const blockRect& band : bands) {
+		blurTemporalBand(stage, temporalPending, output, band, width, height);
+	}
+	//the measured frame becomes the reference. Without changes it's kept, so slow drift still adds up to a change
+	if (!bands.empty()) {
+		std::swap(temporalPrevious, temporalPending);
+	}
+	startBlockDiff(input, width, height);
+}
+
+#ifdef __linux__
+//A request waiting in the daemon's queue, with the client it came from and its frame's memfd
+struct pendingBlurRequest
+{
+	int m_client;
+	blurRequest m_request;
+	int m_frame;
+};
+
+//Daemon side input texture and stage output, kept between requests
+GLuint daemonInput = 0;
+GLuint daemonOutput = 0;
+//Set by the SIGUSR1 handler, the trace is written from the daemon loop
+volatile sig_atomic_t traceDumpRequested = 0;
+
+//Blurs a client's frame in place in its shared memory
+blurReply processBlurRequest(const pendingBlurRequest& pending) {
+	traceScope trace("daemonRequest");
+	const blurRequest& request = pending.m_request;
+	blurReply reply = { request.m_id, -1, 0 };
+	GLint maxTextureSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	if (request.m_width <= 0 || request.m_height <= 0 || request.m_width > maxTextureSize || request.m_height > maxTextureSize
+		|| request.m_stride < request.m_width * 4 || request.m_stride % 4 != 0 || request.m_iterations <= 0
+		|| request.m_iterations > maxBlurIterations || request.m_kernelSize < 1 || request.m_kernelSize > 255) {
+		return reply;
+	}
+	size_t bytes = size_t(request.m_stride) * request.m_height;
+	//a frame smaller than the request says, or one the client could still shrink, would fault once mapped
+	struct stat frameStat;
+	int seals = fcntl(pending.m_frame, F_GET_SEALS);
+	if (fstat(pending.m_frame, &frameStat) != 0 || size_t(frameStat.st_size) < bytes || seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		return reply;
+	}
+	void* pixels = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, pending.m_frame, 0);
+	if (pixels == MAP_FAILED) {
+		return reply;
+	}
+	double start = glfwGetTime();
+
+	blur = request.m_stage != BLUR_FAST;
+	fastBlur = !blur;
+	half = false;
+	wideBlur = false;
+	multiRadius = false;
+	blurIterations = request.m_iterations;
+	if (kernelType != KERNEL_GAUSSIAN || kernelSize != request.m_kernelSize) {
+		kernelType = KERNEL_GAUSSIAN;
+		calculateKernel(request.m_kernelSize);
+	}
+	//the stage textures are only reallocated when the frame size changes
+	bool resized = externalInputSize != glm::vec2(request.m_width, request.m_height);
+	externalInput = true;
+	if (resized) {
+		externalInputSize = glm::vec2(request.m_width, request.m_height);
+		blurDirty = true;
+		fastBlurDirty = true;
+	}
+	if (daemonInput == 0) {
+		glGenTextures(1, &daemonInput);
+		glBindTexture(GL_TEXTURE_2D, daemonInput);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		resized = true;
+	}
+	int uploadTrace = beginTrace("upload");
+	glBindTexture(GL_TEXTURE_2D, daemonInput);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, request.m_stride / 4);
+	if (resized) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, request.m_width, request.m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		trackTexture(daemonInput, "daemonInput", textureBytes(request.m_width, request.m_height, false));
+	}
+	else {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, request.m_width, request.m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	endTrace(uploadTrace);
+
+	if (fastBlur) {
+		fastBlurTexture(daemonInput, daemonOutput);
+	}
+	else {
+		simpleBlurTexture(daemonInput, daemonOutput);
+	}
+	if (daemonOutput == 0) {
+		//try allocating again on the next request, other textures may have been freed by then
+		blurDirty = true;
+		fastBlurDirty = true;
+		munmap(pixels, bytes);
+		return reply;
+	}
+
+	traceScope readbackTrace("readback");
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, daemonOutput, 0);
+	glPixelStorei(GL_PACK_ROW_LENGTH, request.m_stride / 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, request.m_width, request.m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	munmap(pixels, bytes);
+
+	reply.m_status = 0;
+	reply.m_milliseconds = (glfwGetTime() - start) * 1000;
+	return reply;
+}
+
+//Serves blur requests on a unix socket (defaultBlurSocket if null) until killed. The context, shaders and stage textures stay warm
+//between requests. Each poll round collects at most one request per client into a batch, which is sorted
+//so frames of the same size and stage run back to back without reallocating
+int runBlurDaemon(const char* socketPath) {
+	if (!socketPath) {
+		socketPath = defaultBlurSocket;
+	}
+	//a client disconnecting before its reply is written shouldn't kill the daemon
+	signal(SIGPIPE, SIG_IGN);
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+	unlink(socketPath);
+	if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+		std::cout << "Failed to listen on " << socketPath << std::endl;
+		return -1;
+	}
+	std::cout << "Blur daemon listening on " << socketPath << std::endl;
+
+	//SIGUSR1 writes the trace ring to tracePath
+	signal(SIGUSR1, [](int) { traceDumpRequested = 1; });
+	std::cout << "Send SIGUSR1 to process " << getpid() << " to write a trace" << std::endl;
+
+	std::vector<pollfd> sockets = { { listener, POLLIN, 0 } };
+	//partially received requests, per client socket
+	std::map<int, blurRequestReader> readers;
+	std::vector<pendingBlurRequest> batch;
+	auto dropClient = [&](int client) {
+		for (size_t i = 1; i < sockets.size(); i++) {
+			if (sockets[i].fd == client) {
+				close(client);
+				sockets[i].fd = -1;
+				readers.erase(client);
+			}
+		}
+	};
+	while (true) {
+		int ready = poll(&sockets[0], sockets.size(), -1);
+		if (traceDumpRequested) {
+			traceDumpRequested = 0;
+			dumpTrace(tracePath);
+		}
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		for (size_t i = 1; i < sockets.size(); i++) {
+			if (sockets[i].revents == 0) {
+				continue;
+			}
+			pendingBlurRequest pending;
+			pending.m_client = sockets[i].fd;
+			int result = readBlurRequest(sockets[i].fd, readers[sockets[i].fd], pending.m_request, pending.m_frame);
+			if (result > 0) {
+				batch.push_back(pending);
+			}
+			else if (result < 0) {
+				//disconnected or sent something malformed
+				dropClient(sockets[i].fd);
+			}
+		}
+		if (sockets[0].revents & POLLIN) {
+			//clients are non-blocking so one that stops reading its replies can't stall the daemon
+			int client = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+			if (client >= 0) {
+				sockets.push_back({ client, POLLIN, 0 });
+			}
+		}
+
+		std::stable_sort(batch.begin(), batch.end(), [](const pendingBlurRequest& a, const pendingBlurRequest& b) {
+			if (a.m_request.m_width != b.m_request.m_width)
+				return a.m_request.m_width < b.m_request.m_width;
+			if (a.m_request.m_height != b.m_request.m_height)
+				return a.m_request.m_height < b.m_request.m_height;
+			return a.m_request.m_stage < b.m_request.m_stage;
+		});
+		for (const pendingBlurRequest& pending : batch) {
+			blurReply reply = processBlurRequest(pending);
+			if (!writeAll(pending.m_client, &reply, sizeof(reply))) {
+				dropClient(pending.m_client);
+			}
+			close(pending.m_frame);
+		}
+		batch.clear();
+		sockets.erase(std::remove_if(sockets.begin() + 1, sockets.end(), [](const pollfd& entry) { return entry.fd < 0; }), sockets.end());
+	}
+	close(listener);
+	return 0;
+}
+#else
+int runBlurDaemon(const char* socketPath) {
+	std::cout << "The blur daemon needs memfd and unix sockets, which are only available on Linux" << std::endl;
+	return -1;
+}
+#endif
@@ -0,0 +1,25 @@
+#version 330 core
+layout(location = 0) out vec4 Low;
+layout(location = 1) out vec4 High;
+
+// texture sampler
+uniform sampler2D image;
+uniform int blockSize;
+
+// one fragment per tile: the smallest and largest value of each channel within it
+void main()
+{
+	ivec2 size=textureSize(image,0);
+	ivec2 origin=ivec2(gl_FragCoord.xy)*blockSize;
+	vec4 low=vec4(1.0);
+	vec4 high=vec4(0.0);
+	for(int y=0;y<blockSize;++y){
+		for(int x=0;x<blockSize;++x){
+			vec4 value=texelFetch(image,min(origin+ivec2(x,y),size-1),0);
+			low=min(low,value);
+			high=max(high,value);
+		}
+	}
+	Low=low;
+	High=high;
+}
\ No newline at end of file